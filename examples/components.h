@@ -14,10 +14,6 @@ struct TransformComponent {
 		TransformComponent c = {};
 		return c;
 	}
-
-	void Destroy()
-	{
-	}
 };
 
 struct RandomThingComponent {
@@ -30,8 +26,4 @@ struct RandomThingComponent {
 		RandomThingComponent c = {};
 		return c;
 	}
-
-	void Destroy()
-	{
-	}
 };
@@ -3,4 +3,6 @@
 void BasicUsageExample();
 void BasicSharedAuthorityExample();
 void BasicUsageExample();
-void MultithreadedWorldProcessingExample();
\ No newline at end of file
+void MultithreadedWorldProcessingExample();
+void ProcessSchedulingExample();
+void QueryExample();
\ No newline at end of file
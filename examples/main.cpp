@@ -9,5 +9,9 @@ int main(int argc, char **argv)
 	printf("Press enter to continue\n"); getchar();
 	MultithreadedWorldProcessingExample();
 	printf("Press enter to continue\n"); getchar();
+	ProcessSchedulingExample();
+	printf("Press enter to continue\n"); getchar();
+	QueryExample();
+	printf("Press enter to continue\n"); getchar();
 	return 0;
 }
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include <aurumecs/iprocess.h>
 #include <aurumecs/st_dispatcher.h>
 #include <aurumecs/mt_dispatcher.h>
+#include <aurumecs/ws_dispatcher.h>
 #include "examples.h"
 #include "components.h"
 
@@ -19,6 +20,8 @@ using namespace au;
 // includes the spawning thread.
 using STGameWorld = World<SingleThreadedDispatcher, TransformComponent, RandomThingComponent>;
 using MTGameWorld = World<MultiThreadedDispatcher<1>, TransformComponent, RandomThingComponent>;
+// Same thread count, but threads balance the load by stealing processes from each other
+using WSGameWorld = World<WorkStealingDispatcher<1>, TransformComponent, RandomThingComponent>;
 
 // NOTE: This macro's only meant for examples
 #define PROCESS_BOILERPLATE(proc_type_id) inline double TimeTaken() const override { return 0.0; } \
@@ -34,6 +37,9 @@ private:
 public:
 	PROCESS_BOILERPLATE(0);
 
+	// Lets the world run this process alongside processes of other groups that leave transforms alone
+	using AuthorityComponents = AuthoritySet<TransformComponent>;
+
 	TransformUpdateProcess(WorldType* owner) : mOwner(owner)
 	{
 	}
@@ -61,6 +67,8 @@ private:
 public:
 	PROCESS_BOILERPLATE(1);
 
+	using AuthorityComponents = AuthoritySet<RandomThingComponent>;
+
 	RandomThingProcess(WorldType* owner) : mOwner(owner)
 	{
 	}
@@ -129,8 +137,10 @@ void MultithreadedWorldProcessingExample()
 		printf("----- Loop %d\n", n);
 		auto st_time = RunExample<STGameWorld>(k_entity_count, k_iteration_count);
 		auto mt_time = RunExample<MTGameWorld>(k_entity_count, k_iteration_count);
+		auto ws_time = RunExample<WSGameWorld>(k_entity_count, k_iteration_count);
 
 		printf("Singlethreaded took %.6f ms\nMultithreaded took %.6f ms\nMT = %.4f %% of ST\n", st_time, mt_time, 100.f * ((float) mt_time) / st_time);
+		printf("Work stealing took %.6f ms\nWS = %.4f %% of ST\n", ws_time, 100.f * ((float) ws_time) / st_time);
 		printf("-------------\n\n");
 	}
 
@@ -0,0 +1,186 @@
+// Shows how processes declaring the components they access get scheduled. Processes of a group normally wait
+// for the previous groups to finish, but the world merges groups whose processes don't conflict into a single
+// dispatcher batch.
+
+#include <cstdio>
+#include <aurumecs/world.h>
+#include <aurumecs/component.h>
+#include <aurumecs/iprocess.h>
+#include <aurumecs/st_dispatcher.h>
+#include <aurumecs/mt_dispatcher.h>
+#include "examples.h"
+#include "components.h"
+
+using namespace au;
+
+using STGameWorld = World<SingleThreadedDispatcher, TransformComponent, RandomThingComponent>;
+using MTGameWorld = World<MultiThreadedDispatcher<1>, TransformComponent, RandomThingComponent>;
+
+// NOTE: This macro's only meant for examples
+#define PROCESS_BOILERPLATE(proc_type_id, proc_group_id) inline double TimeTaken() const override { return 0.0; } \
+	inline size_t GetProcessTypeId() const override { return proc_type_id; } \
+	inline size_t GetProcessGroupId() const override { return proc_group_id; } \
+	static const size_t ProcessTypeId = proc_type_id; \
+	static const size_t ProcessGroupId = proc_group_id
+
+// Group 0, moves entities
+template<typename WorldType>
+class MovementProcess : public IProcess {
+private:
+	WorldType* mOwner;
+public:
+	PROCESS_BOILERPLATE(0, 0);
+
+	using AuthorityComponents = AuthoritySet<TransformComponent>;
+
+	MovementProcess(WorldType* owner) : mOwner(owner)
+	{
+	}
+
+	void Execute(double timeSec) override
+	{
+		auto it = mOwner->template GetComponentIterator<AuthoritySet<TransformComponent>, TransformComponent>();
+
+		while (it.Advance())
+		{
+			auto* transform = it.template Edit<TransformComponent>();
+
+			for (int n = 0; n < 3; n++)
+				transform->Position[n] += (float) (transform->Velocity[n] * timeSec);
+		}
+	}
+};
+
+// Group 1, leaves transforms alone so it runs alongside group 0
+template<typename WorldType>
+class RandomizeProcess : public IProcess {
+private:
+	WorldType* mOwner;
+public:
+	PROCESS_BOILERPLATE(1, 1);
+
+	using AuthorityComponents = AuthoritySet<RandomThingComponent>;
+
+	RandomizeProcess(WorldType* owner) : mOwner(owner)
+	{
+	}
+
+	void Execute(double timeSec) override
+	{
+		auto it = mOwner->template GetComponentIterator<AuthoritySet<RandomThingComponent>, RandomThingComponent>();
+
+		while (it.Advance())
+		{
+			auto* thing = it.template Edit<RandomThingComponent>();
+			thing->RandomThing = (thing->RandomThing * 1103515245 + 12345) & 0x7fffffff;
+		}
+	}
+};
+
+// Group 1, edits transforms when present, which conflicts with group 0 and waits for it
+template<typename WorldType>
+class JitterProcess : public IProcess {
+private:
+	WorldType* mOwner;
+public:
+	PROCESS_BOILERPLATE(2, 1);
+
+	using ReadComponents = ComponentSet<RandomThingComponent>;
+	using OptionalComponents = OptionalSet<TransformComponent>;
+
+	JitterProcess(WorldType* owner) : mOwner(owner)
+	{
+	}
+
+	void Execute(double timeSec) override
+	{
+		auto it = mOwner->template GetComponentIterator<AuthoritySet<>, OptionalSet<TransformComponent>, RandomThingComponent>();
+
+		while (it.Advance())
+		{
+			auto* transform = it.template EditOptional<TransformComponent>();
+
+			if (transform)
+				transform->Rotation[1] += (it.template Get<RandomThingComponent>().RandomThing % 7) * 0.001f;
+		}
+	}
+};
+
+// Group 2, only reads double buffered transforms, which writers leave alone, so it runs alongside group 0
+template<typename WorldType>
+class BoundsProcess : public IProcess {
+private:
+	WorldType* mOwner;
+	float mMaxHeight = 0.f;
+public:
+	PROCESS_BOILERPLATE(3, 2);
+
+	using ReadComponents = ComponentSet<TransformComponent>;
+
+	BoundsProcess(WorldType* owner) : mOwner(owner)
+	{
+	}
+
+	void Execute(double timeSec) override
+	{
+		auto it = mOwner->template GetReadComponentIterator<TransformComponent>();
+
+		while (it.Advance())
+		{
+			const auto& transform = it.template Get<TransformComponent>();
+
+			if (transform.Position[1] > mMaxHeight)
+				mMaxHeight = transform.Position[1];
+		}
+	}
+
+	inline float GetMaxHeight() const
+	{
+		return mMaxHeight;
+	}
+};
+
+#undef PROCESS_BOILERPLATE
+
+template<typename WorldType>
+void RunSchedulingExample(const char* name)
+{
+	WorldType world;
+
+	for (int n = 0; n < 100; n++)
+	{
+		auto entity = world.AddEntity();
+		auto thing = RandomThingComponent::Create();
+		thing.RandomThing = n;
+		world.AddComponent(entity, thing);
+
+		// Only half the entities move, the others are skipped by the jitter process
+		if ((n % 2) == 0)
+		{
+			auto transform = TransformComponent::Create();
+			transform.Velocity[1] = n / 10.f;
+			world.AddComponent(entity, transform);
+		}
+	}
+
+	auto* bounds = new BoundsProcess<WorldType>(&world);
+	world.AddProcess(new MovementProcess<WorldType>(&world), 0);
+	world.AddProcess(new RandomizeProcess<WorldType>(&world), 1);
+	world.AddProcess(new JitterProcess<WorldType>(&world), 1);
+	world.AddProcess(bounds, 2);
+
+	for (int n = 0; n < 10; n++)
+		world.Process(0.016);
+
+	printf("%s: 3 process groups run in %u dispatcher batches, max height %.3f\n", name, (unsigned) world.CountProcessBatches(), bounds->GetMaxHeight());
+}
+
+void ProcessSchedulingExample()
+{
+	printf("Process scheduling example ---------------\n");
+
+	RunSchedulingExample<STGameWorld>("Singlethreaded");
+	RunSchedulingExample<MTGameWorld>("Multithreaded");
+
+	printf("Process scheduling example end ---------------\n");
+}
\ No newline at end of file
@@ -0,0 +1,192 @@
+// Shows the ways processes can select entities besides plain component iterators: ForEach and ParallelForEach
+// walk the component buffers directly, while Changed<>, Added<> and Without<> narrow down what iterators visit.
+
+#include <cstdio>
+#include <atomic>
+#include <aurumecs/world.h>
+#include <aurumecs/component.h>
+#include <aurumecs/iprocess.h>
+#include <aurumecs/st_dispatcher.h>
+#include <aurumecs/mt_dispatcher.h>
+#include "examples.h"
+#include "components.h"
+
+using namespace au;
+
+using STGameWorld = World<SingleThreadedDispatcher, TransformComponent, RandomThingComponent>;
+using MTGameWorld = World<MultiThreadedDispatcher<1>, TransformComponent, RandomThingComponent>;
+
+// NOTE: This macro's only meant for examples
+#define PROCESS_BOILERPLATE(proc_type_id, proc_group_id) inline double TimeTaken() const override { return 0.0; } \
+	inline size_t GetProcessTypeId() const override { return proc_type_id; } \
+	inline size_t GetProcessGroupId() const override { return proc_group_id; } \
+	static const size_t ProcessTypeId = proc_type_id; \
+	static const size_t ProcessGroupId = proc_group_id
+
+// Moves every entity having a transform, spread over the dispatcher's threads
+template<typename WorldType>
+class ParallelMoveProcess : public IProcess {
+private:
+	WorldType* mOwner;
+public:
+	PROCESS_BOILERPLATE(0, 0);
+
+	using AuthorityComponents = AuthoritySet<TransformComponent>;
+
+	ParallelMoveProcess(WorldType* owner) : mOwner(owner)
+	{
+	}
+
+	void Execute(double timeSec) override
+	{
+		mOwner->template ParallelForEach<AuthoritySet<TransformComponent>, TransformComponent>([timeSec](TransformComponent& transform) {
+			for (int n = 0; n < 3; n++)
+				transform.Position[n] += (float) (transform.Velocity[n] * timeSec);
+		});
+	}
+};
+
+// Edits a tenth of the random things every tick, which the report process sees through Changed<>
+template<typename WorldType>
+class ThingChangeProcess : public IProcess {
+private:
+	WorldType* mOwner;
+	int mTick = 0;
+public:
+	PROCESS_BOILERPLATE(1, 0);
+
+	using AuthorityComponents = AuthoritySet<RandomThingComponent>;
+
+	ThingChangeProcess(WorldType* owner) : mOwner(owner)
+	{
+	}
+
+	void Execute(double timeSec) override
+	{
+		auto it = mOwner->template GetComponentIterator<AuthoritySet<RandomThingComponent>, RandomThingComponent>();
+
+		while (it.Advance())
+		{
+			if ((it.template Get<RandomThingComponent>().RandomThing % 10) == (mTick % 10))
+				it.template Edit<RandomThingComponent>()->RandomThing += 10;
+		}
+
+		mTick++;
+	}
+};
+
+// Gives a few entities without a transform one, they show up through Added<> once the world adds them
+template<typename WorldType>
+class TransformSpawnProcess : public IProcess {
+private:
+	WorldType* mOwner;
+public:
+	PROCESS_BOILERPLATE(2, 0);
+
+	using ReadComponents = ComponentSet<RandomThingComponent, Without<TransformComponent>>;
+
+	TransformSpawnProcess(WorldType* owner) : mOwner(owner)
+	{
+	}
+
+	void Execute(double timeSec) override
+	{
+		auto it = mOwner->template GetReadComponentIterator<RandomThingComponent, Without<TransformComponent>>();
+		auto transform = TransformComponent::Create();
+		transform.Velocity[1] = 1.f;
+
+		for (int n = 0; (n < 5) && it.Advance(); n++)
+			mOwner->QueueAddComponent(it.GetEntityRef(), transform);
+	}
+};
+
+template<typename WorldType>
+class QueryReportProcess : public IProcess {
+private:
+	WorldType* mOwner;
+	int mTick = 0;
+public:
+	PROCESS_BOILERPLATE(3, 1);
+
+	using ReadComponents = ComponentSet<TransformComponent, RandomThingComponent>;
+
+	QueryReportProcess(WorldType* owner) : mOwner(owner)
+	{
+	}
+
+	void Execute(double timeSec) override
+	{
+		// ParallelForEach calls the function concurrently, so results have to be combined atomically
+		std::atomic<int> moving{ 0 };
+		mOwner->template ParallelForEach<TransformComponent>([&moving](const TransformComponent& transform) {
+			if (transform.Position[1] > 0.f)
+				moving++;
+		});
+
+		// ForEach over several components only visits the entities having all of them
+		int moving_things = 0;
+		mOwner->template ForEach<TransformComponent, RandomThingComponent>([&moving_things](const TransformComponent&, const RandomThingComponent& thing) {
+			moving_things += thing.RandomThing;
+		});
+
+		int changed = 0, added = 0, still = 0;
+
+		auto changed_it = mOwner->template GetReadComponentIterator<Changed<RandomThingComponent>>();
+		while (changed_it.Advance())
+			changed++;
+
+		auto added_it = mOwner->template GetReadComponentIterator<Added<TransformComponent>>();
+		while (added_it.Advance())
+			added++;
+
+		auto still_it = mOwner->template GetReadComponentIterator<RandomThingComponent, Without<TransformComponent>>();
+		while (still_it.Advance())
+			still++;
+
+		printf("Tick %d: %d moving (things sum to %d), %d changed things, %d added transforms, %d without transforms\n",
+			mTick, moving.load(), moving_things, changed, added, still);
+		mTick++;
+	}
+};
+
+#undef PROCESS_BOILERPLATE
+
+template<typename WorldType>
+void RunQueryExample(const char* name)
+{
+	printf("----- %s\n", name);
+	WorldType world;
+
+	for (int n = 0; n < 100; n++)
+	{
+		auto entity = world.AddEntity();
+		auto thing = RandomThingComponent::Create();
+		thing.RandomThing = n;
+		world.AddComponent(entity, thing);
+
+		if (n < 20)
+		{
+			auto transform = TransformComponent::Create();
+			transform.Velocity[1] = 1.f;
+			world.AddComponent(entity, transform);
+		}
+	}
+
+	world.AddProcess(new ParallelMoveProcess<WorldType>(&world), 0);
+	world.AddProcess(new ThingChangeProcess<WorldType>(&world), 0);
+	world.AddProcess(new TransformSpawnProcess<WorldType>(&world), 0);
+	world.AddProcess(new QueryReportProcess<WorldType>(&world), 1);
+
+	for (int n = 0; n < 5; n++)
+		world.Process(0.016);
+}
+
+void QueryExample()
+{
+	printf("Query example ---------------\n");
+
+	RunQueryExample<STGameWorld>("Singlethreaded");
+	RunQueryExample<MTGameWorld>("Multithreaded");
+
+	printf("Query example end ---------------\n");
+}
\ No newline at end of file
@@ -0,0 +1,305 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace au {
+	namespace detail {
+		static const std::size_t kLargePageSize = 2 * 1024 * 1024;
+
+		// Maps zeroed pages straight from the OS. Large pages are attempted first when requested (MAP_HUGETLB or
+		// MEM_LARGE_PAGES, both of which need to be enabled on the system), falling back to regular pages which are
+		// then marked as eligible for transparent huge pages where supported.
+		inline void* MapPages(std::size_t size, bool largePages)
+		{
+#ifdef _WIN32
+			if (largePages)
+			{
+				std::size_t large_page_size = GetLargePageMinimum();
+
+				if ((large_page_size > 0) && ((size % large_page_size) == 0))
+				{
+					if (void* ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE))
+						return ptr;
+				}
+			}
+
+			return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+			void* ptr = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+			if (largePages && ((size % kLargePageSize) == 0))
+				ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+			if (ptr == MAP_FAILED)
+			{
+				ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+				if (ptr == MAP_FAILED)
+					return nullptr;
+
+#ifdef MADV_HUGEPAGE
+				if (largePages)
+					madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+			}
+
+			return ptr;
+#endif
+		}
+
+		inline void UnmapPages(void* ptr, std::size_t size)
+		{
+#ifdef _WIN32
+			VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+			munmap(ptr, size);
+#endif
+		}
+
+		// Lets the OS reclaim the physical memory behind mapped pages, which stay mapped and may read back as
+		// anything (zeros on Linux) once they're touched again
+		inline void DiscardPages(void* ptr, std::size_t size)
+		{
+#ifdef _WIN32
+			VirtualAlloc(ptr, size, MEM_RESET, PAGE_READWRITE);
+#else
+			madvise(ptr, size, MADV_DONTNEED);
+#endif
+		}
+	}
+
+	// Memory arena handing out 64 byte aligned blocks carved from large OS mapped regions, optionally backed by
+	// large pages. Blocks are rounded up to power of two size classes and recycled through per class free lists,
+	// so containers that grow repeatedly reuse the memory released by their previous buffers instead of going
+	// back to the OS. Requests too large for a region get their own mapping. Threadsafe.
+	// Free blocks are never coalesced nor split and regions are only unmapped along with the arena, so each size
+	// class keeps as many blocks as were ever live at once. Trim() returns the physical memory of free blocks
+	// spanning whole pages to the OS, smaller ones stay resident until reused.
+	class AlignedArena {
+	public:
+		static const std::size_t kAlignment = 64;
+		static const std::size_t kDefaultRegionSize = 64 * 1024 * 1024;
+	private:
+		static const std::size_t kSizeClassCount = sizeof(std::size_t) * 8;
+
+		struct Region {
+			void* Memory;
+			std::size_t Size;
+		};
+
+		std::mutex mMutex;
+		std::vector<Region> mRegions;
+		std::vector<void*> mFreeBlocks[kSizeClassCount];
+		unsigned char* mCursor = nullptr;
+		unsigned char* mRegionEnd = nullptr;
+		std::size_t mRegionSize;
+		bool mLargePages;
+
+		static inline std::size_t GetSizeClass(std::size_t size)
+		{
+			std::size_t size_class = 6; // kAlignment
+
+			while ((std::size_t(1) << size_class) < size)
+				size_class++;
+
+			return size_class;
+		}
+
+		inline std::size_t RoundToPages(std::size_t size) const
+		{
+			std::size_t page = mLargePages ? detail::kLargePageSize : 4096;
+			return (size + page - 1) & ~(page - 1);
+		}
+	public:
+		explicit AlignedArena(bool largePages = false, std::size_t regionSize = kDefaultRegionSize)
+			: mRegionSize(regionSize), mLargePages(largePages)
+		{
+		}
+
+		AlignedArena(const AlignedArena&) = delete;
+		AlignedArena& operator=(const AlignedArena&) = delete;
+
+		~AlignedArena()
+		{
+			for (auto& region : mRegions)
+				detail::UnmapPages(region.Memory, region.Size);
+		}
+
+		void* Allocate(std::size_t size)
+		{
+			std::size_t size_class = GetSizeClass(size);
+			std::size_t block_size = std::size_t(1) << size_class;
+
+			// Large blocks get their own mapping, they're returned to the OS when deallocated
+			if (block_size > mRegionSize / 4)
+			{
+				void* ptr = detail::MapPages(RoundToPages(size), mLargePages);
+
+				if (!ptr)
+					throw std::bad_alloc();
+
+				return ptr;
+			}
+
+			std::lock_guard<std::mutex> lock(mMutex);
+			auto& free_blocks = mFreeBlocks[size_class];
+
+			if (!free_blocks.empty())
+			{
+				void* ptr = free_blocks.back();
+				free_blocks.pop_back();
+				return ptr;
+			}
+
+			if ((std::size_t) (mRegionEnd - mCursor) < block_size)
+			{
+				std::size_t region_size = RoundToPages(mRegionSize);
+				void* memory = detail::MapPages(region_size, mLargePages);
+
+				if (!memory)
+					throw std::bad_alloc();
+
+				mRegions.push_back({ memory, region_size });
+				mCursor = (unsigned char*) memory;
+				mRegionEnd = mCursor + region_size;
+			}
+
+			void* ptr = mCursor;
+			mCursor += block_size;
+			return ptr;
+		}
+
+		void Deallocate(void* ptr, std::size_t size)
+		{
+			if (!ptr)
+				return;
+
+			std::size_t size_class = GetSizeClass(size);
+
+			if ((std::size_t(1) << size_class) > mRegionSize / 4)
+			{
+				detail::UnmapPages(ptr, RoundToPages(size));
+			}
+			else
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mFreeBlocks[size_class].push_back(ptr);
+			}
+		}
+
+		// Discards the pages lying entirely within free blocks, the blocks remain available for reuse
+		void Trim()
+		{
+			std::size_t page = mLargePages ? detail::kLargePageSize : 4096;
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			for (std::size_t size_class = 0; size_class < kSizeClassCount; size_class++)
+			{
+				std::size_t block_size = std::size_t(1) << size_class;
+
+				if (block_size < page)
+					continue;
+
+				for (void* block : mFreeBlocks[size_class])
+				{
+					std::uintptr_t first = (reinterpret_cast<std::uintptr_t>(block) + page - 1) & ~std::uintptr_t(page - 1);
+					std::uintptr_t last = (reinterpret_cast<std::uintptr_t>(block) + block_size) & ~std::uintptr_t(page - 1);
+
+					if (first < last)
+						detail::DiscardPages(reinterpret_cast<void*>(first), last - first);
+				}
+			}
+		}
+
+		inline bool UsesLargePages() const
+		{
+			return mLargePages;
+		}
+
+		// Process wide arenas used by default constructed ArenaAllocators. These are never destroyed so containers
+		// with static storage duration can safely release their memory during shutdown.
+		static AlignedArena& GetDefault(bool largePages)
+		{
+			static AlignedArena* regular_arena = new AlignedArena(false);
+			static AlignedArena* large_page_arena = new AlignedArena(true);
+			return largePages ? *large_page_arena : *regular_arena;
+		}
+	};
+
+	// Standard allocator backed by an AlignedArena, usable as the allocator of a BasicWorld (through
+	// DefaultArenaAllocator/LargePageArenaAllocator) and of any standard container.
+	template<typename T, bool LargePages = false>
+	class ArenaAllocator {
+		template<typename U, bool L>
+		friend class ArenaAllocator;
+
+		AlignedArena* mArena;
+	public:
+		using value_type = T;
+
+		template<typename U>
+		struct rebind {
+			using other = ArenaAllocator<U, LargePages>;
+		};
+
+		ArenaAllocator() : mArena(&AlignedArena::GetDefault(LargePages))
+		{
+		}
+
+		explicit ArenaAllocator(AlignedArena& arena) : mArena(&arena)
+		{
+		}
+
+		template<typename U>
+		ArenaAllocator(const ArenaAllocator<U, LargePages>& other) : mArena(other.mArena)
+		{
+		}
+
+		inline T* allocate(std::size_t count)
+		{
+			static_assert(alignof(T) <= AlignedArena::kAlignment, "T requires a larger alignment than the arena provides.");
+			return static_cast<T*>(mArena->Allocate(count * sizeof(T)));
+		}
+
+		inline void deallocate(T* ptr, std::size_t count)
+		{
+			mArena->Deallocate(ptr, count * sizeof(T));
+		}
+
+		template<typename U>
+		inline bool operator==(const ArenaAllocator<U, LargePages>& other) const
+		{
+			return mArena == other.mArena;
+		}
+
+		template<typename U>
+		inline bool operator!=(const ArenaAllocator<U, LargePages>& other) const
+		{
+			return mArena != other.mArena;
+		}
+	};
+
+	template<typename T>
+	using DefaultArenaAllocator = ArenaAllocator<T, false>;
+
+	template<typename T>
+	using LargePageArenaAllocator = ArenaAllocator<T, true>;
+}
\ No newline at end of file
@@ -1,4 +1,8 @@
 #pragma once
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "type_seqs.h"
 
 namespace au {
 	using ComponentIdType = size_t;
@@ -13,4 +17,117 @@ namespace au {
 	static const bool HasCustomMigrationHandling = true; \
 	static const char* IdName() { return #x; } \
 	size_t OwnerIndex
-#endif
\ No newline at end of file
+#endif
+
+// Optional component traits, placed in the component's body alongside COMPONENT_INFO.
+#ifndef COMPONENT_SPARSE_SET
+// Maintains an entity index -> component slot lookup next to the component's buffers so that
+// random access by entity (World::GetComponent for example) takes constant time.
+#define COMPONENT_SPARSE_SET static const bool UsesSparseSet = true
+#endif
+
+#ifndef COMPONENT_SINGLE_BUFFERED
+// Stores the component in a single buffer which processes read from and write to directly. Halves the type's memory
+// usage and skips its per tick buffer copy, but writes become visible to readers immediately so it should only be
+// used for types that are either never modified or only accessed by the process that has authority over them.
+#define COMPONENT_SINGLE_BUFFERED static const bool IsSingleBuffered = true
+#endif
+
+#ifndef COMPONENT_NO_DESTROY
+// Declares that the component doesn't hold anything that must be released, Destroy() is then never called and
+// may be omitted. Components without a Destroy() member are detected automatically.
+#define COMPONENT_NO_DESTROY static const bool NeedsDestroy = false
+#endif
+
+#ifndef COMPONENT_SOA_FIELDS
+// Stores the listed fields (COMPONENT_SOA_FIELDS(&Transform::X, &Transform::Y) for example) in separate 64 byte aligned
+// arrays, one per field, instead of inside the components, so that loops over a field only touch that field and can
+// be vectorized across entities. Such components are accessed through World::ForEachChunk, World::LoadComponent and
+// World::StoreComponent since they aren't stored as a whole, and can't have a Destroy() member or custom migration.
+#define COMPONENT_SOA_FIELDS(...) static auto SoAFields() { return ::std::make_tuple(__VA_ARGS__); }
+#endif
+
+namespace au {
+	namespace detail {
+		template<typename T, typename = void>
+		struct sparse_set_trait : std::false_type {
+		};
+
+		template<typename T>
+		struct sparse_set_trait<T, typename wrapper<decltype(T::UsesSparseSet)>::type> : std::integral_constant<bool, T::UsesSparseSet> {
+		};
+
+		template<typename T, typename = void>
+		struct single_buffered_trait : std::false_type {
+		};
+
+		template<typename T>
+		struct single_buffered_trait<T, typename wrapper<decltype(T::IsSingleBuffered)>::type> : std::integral_constant<bool, T::IsSingleBuffered> {
+		};
+
+		template<typename T, typename = void>
+		struct has_destroy_member : std::false_type {
+		};
+
+		template<typename T>
+		struct has_destroy_member<T, typename wrapper<decltype(std::declval<T&>().Destroy())>::type> : std::true_type {
+		};
+
+		template<typename T, typename = void>
+		struct needs_destroy_trait : has_destroy_member<T> {
+		};
+
+		template<typename T>
+		struct needs_destroy_trait<T, typename wrapper<decltype(T::NeedsDestroy)>::type> : std::integral_constant<bool, T::NeedsDestroy && has_destroy_member<T>::value> {
+		};
+
+		template<typename T, typename = void>
+		struct soa_trait : std::false_type {
+		};
+
+		template<typename T>
+		struct soa_trait<T, typename wrapper<decltype(T::SoAFields())>::type> : std::true_type {
+		};
+	}
+
+	// Resolves the optional traits of a component type, falling back to defaults for undeclared ones
+	template<typename T>
+	struct component_traits {
+		static const bool sparse_set = detail::sparse_set_trait<T>::value;
+		static const bool single_buffered = detail::single_buffered_trait<T>::value;
+		static const bool needs_destroy = detail::needs_destroy_trait<T>::value;
+		static const bool soa = detail::soa_trait<T>::value;
+	};
+
+	namespace detail {
+		// Whether any of the component types lists SoA fields
+		template<typename... T>
+		struct any_soa : std::false_type {
+		};
+
+		template<typename T, typename... R>
+		struct any_soa<T, R...> : std::integral_constant<bool, component_traits<T>::soa || any_soa<R...>::value> {
+		};
+	}
+
+	namespace detail {
+		template<typename T>
+		inline void DestroyComponentRange(T* components, size_t count, std::true_type)
+		{
+			for (size_t n = 0; n < count; n++)
+				components[n].Destroy();
+		}
+
+		template<typename T>
+		inline void DestroyComponentRange(T*, size_t, std::false_type)
+		{
+		}
+	}
+
+	// Calls Destroy() on count components, compiles to nothing for components that don't need to be destroyed
+	template<typename T>
+	inline void DestroyComponentRange(T* components, size_t count)
+	{
+		detail::DestroyComponentRange(components, count, std::integral_constant<bool, component_traits<T>::needs_destroy>());
+	}
+}
\ No newline at end of file
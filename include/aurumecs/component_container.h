@@ -1,12 +1,628 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
 #include <vector>
+#include "component.h"
 
 namespace au {
-	template<typename T>
+	static const size_t kInvalidComponentSlot = ~size_t(0);
+
+	enum class FutureBufferState : int {
+		Outdated,	// Doesn't reflect the present buffer, it's only brought up to date when someone needs to write to it
+		Syncing,
+		Synced
+	};
+
+	// Versions at which a component type was written for each entity. The two most recent distinct versions are
+	// kept per entity, so a write made at a later version doesn't hide an earlier one from readers still looking
+	// for it. Entities are grouped in blocks which remember their latest version, allowing readers to skip every
+	// entity of a block at once. Versions are only compared for equality so wrapping around is harmless.
+	class ComponentVersionTable {
+	public:
+		static const size_t kBlockSize = 1024;
+	private:
+		std::unique_ptr<std::atomic<std::uint64_t>[]> mVersions;
+		std::unique_ptr<std::atomic<unsigned>[]> mBlockVersions;
+		size_t mCapacity = 0;
+	public:
+		// Records a write to an entity's component. Threadsafe as long as every concurrent writer uses the same version.
+		inline void Mark(size_t index, unsigned version)
+		{
+			std::uint64_t versions = mVersions[index].load(std::memory_order_relaxed);
+
+			if ((unsigned) versions != version)
+				mVersions[index].store((versions << 32) | version, std::memory_order_relaxed);
+
+			auto& block = mBlockVersions[index / kBlockSize];
+
+			if (block.load(std::memory_order_relaxed) != version)
+				block.store(version, std::memory_order_relaxed);
+		}
+
+		inline bool WrittenAt(size_t index, unsigned version) const
+		{
+			if (index >= mCapacity)
+				return false;
+
+			std::uint64_t versions = mVersions[index].load(std::memory_order_relaxed);
+			return ((unsigned) versions == version) || ((unsigned) (versions >> 32) == version);
+		}
+
+		// Whether any entity of the block may have been written at version, meaning its latest version is either
+		// version itself or the one following it
+		inline bool BlockWrittenAt(size_t block, unsigned version) const
+		{
+			if (block * kBlockSize >= mCapacity)
+				return false;
+
+			unsigned latest = mBlockVersions[block].load(std::memory_order_relaxed);
+			return (latest == version) || (latest == version + 1);
+		}
+
+		// Forgets the versions of an entity slot's previous occupant, not threadsafe
+		inline void Reset(size_t index)
+		{
+			mVersions[index].store(0, std::memory_order_relaxed);
+		}
+
+		// Grows the table to hold at least count entities, not threadsafe
+		void Reserve(size_t count)
+		{
+			if (count <= mCapacity)
+				return;
+
+			size_t capacity = std::max(count, mCapacity * 2);
+			size_t blocks = (capacity + kBlockSize - 1) / kBlockSize;
+			std::unique_ptr<std::atomic<std::uint64_t>[]> versions(new std::atomic<std::uint64_t>[capacity]);
+			std::unique_ptr<std::atomic<unsigned>[]> block_versions(new std::atomic<unsigned>[blocks]);
+
+			for (size_t n = 0; n < capacity; n++)
+				versions[n].store((n < mCapacity) ? mVersions[n].load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+
+			for (size_t n = 0; n < blocks; n++)
+				block_versions[n].store((n * kBlockSize < mCapacity) ? mBlockVersions[n].load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+
+			mVersions.swap(versions);
+			mBlockVersions.swap(block_versions);
+			mCapacity = capacity;
+		}
+
+		// Moves the versions of the first count entities to new_indices, entities moved to an index past the
+		// capacity are forgotten. Blocks can't tell which entities they got so they're all stamped with version,
+		// the current write version. Not threadsafe.
+		void Permute(const size_t* new_indices, size_t count, unsigned version)
+		{
+			std::unique_ptr<std::atomic<std::uint64_t>[]> versions(new std::atomic<std::uint64_t>[mCapacity]);
+
+			for (size_t n = 0; n < mCapacity; n++)
+				versions[n].store(0, std::memory_order_relaxed);
+
+			for (size_t n = 0; n < std::min(count, mCapacity); n++)
+			{
+				if (new_indices[n] < mCapacity)
+					versions[new_indices[n]].store(mVersions[n].load(std::memory_order_relaxed), std::memory_order_relaxed);
+			}
+
+			for (size_t n = 0; n * kBlockSize < mCapacity; n++)
+				mBlockVersions[n].store(version, std::memory_order_relaxed);
+
+			mVersions.swap(versions);
+		}
+	};
+
+	namespace detail {
+		// Byte range of a component stored in its own array by SoABuffer
+		struct FieldLane {
+			size_t Offset;
+			size_t Size;
+		};
+
+		template<typename T, typename M>
+		inline size_t GetFieldOffset(M T::* field)
+		{
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+			const T* object = reinterpret_cast<const T*>(&storage);
+			return reinterpret_cast<const unsigned char*>(&(object->*field)) - reinterpret_cast<const unsigned char*>(object);
+		}
+
+		template<typename T>
+		struct FieldLaneCollector {
+			std::vector<FieldLane>* Lanes;
+
+			template<typename M>
+			inline void operator()(M T::* field)
+			{
+				Lanes->push_back({ GetFieldOffset(field), sizeof(M) });
+			}
+		};
+
+		// Fields listed by T's COMPONENT_SOA_FIELDS, in declaration order
+		template<typename T>
+		inline const std::vector<FieldLane>& GetFieldLanes()
+		{
+			static const std::vector<FieldLane> lanes = []() {
+				std::vector<FieldLane> result;
+				tuple_for_each(T::SoAFields(), FieldLaneCollector<T>{ &result });
+				return result;
+			}();
+
+			return lanes;
+		}
+	}
+
+	/// Buffer of a component type listing fields with COMPONENT_SOA_FIELDS. The components are kept in a vector like
+	/// those of any other type, holding their owner and unlisted fields, while each listed field lives in its own 64
+	/// byte aligned array (a lane) indexed like the vector. Structural operations move the lanes along with the
+	/// vector but element access only reaches the latter, the listed fields of its components are unspecified:
+	/// whole components are read and written through LoadComponentAt and StoreComponentAt.
+	template<typename T, typename Allocator = std::allocator<T>>
+	class SoABuffer {
+	public:
+		using value_type = T;
+		using iterator = typename std::vector<T, Allocator>::iterator;
+		using const_iterator = typename std::vector<T, Allocator>::const_iterator;
+
+		static const size_t kLaneAlignment = 64;
+	private:
+		using ByteAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<unsigned char>;
+
+		std::vector<T, Allocator> mComponents;
+		// Every lane holds mLaneCapacity fields and starts on a kLaneAlignment boundary past the storage's start
+		std::vector<unsigned char, ByteAllocator> mLaneStorage;
+		size_t mLaneCapacity = 0;
+	public:
+		SoABuffer() = default;
+		SoABuffer(SoABuffer&&) = default;
+		SoABuffer& operator=(SoABuffer&&) = default;
+
+		// The copy's lanes may not start at the same offsets within its storage, they're copied one at a time
+		SoABuffer(const SoABuffer& other) : mComponents(other.mComponents)
+		{
+			ReserveLanes(other.size());
+			CopyLanes(other, 0, 0, other.size());
+		}
+
+		SoABuffer& operator=(const SoABuffer& other)
+		{
+			if (this != &other)
+			{
+				mComponents = other.mComponents;
+				ReserveLanes(other.size());
+				CopyLanes(other, 0, 0, other.size());
+			}
+
+			return *this;
+		}
+
+		inline size_t size() const
+		{
+			return mComponents.size();
+		}
+
+		inline bool empty() const
+		{
+			return mComponents.empty();
+		}
+
+		inline T* data()
+		{
+			return mComponents.data();
+		}
+
+		inline const T* data() const
+		{
+			return mComponents.data();
+		}
+
+		inline iterator begin()
+		{
+			return mComponents.begin();
+		}
+
+		inline const_iterator begin() const
+		{
+			return mComponents.begin();
+		}
+
+		inline iterator end()
+		{
+			return mComponents.end();
+		}
+
+		inline const_iterator end() const
+		{
+			return mComponents.end();
+		}
+
+		inline T& operator[](size_t index)
+		{
+			return mComponents[index];
+		}
+
+		inline const T& operator[](size_t index) const
+		{
+			return mComponents[index];
+		}
+
+		inline T& back()
+		{
+			return mComponents.back();
+		}
+
+		inline const T& back() const
+		{
+			return mComponents.back();
+		}
+
+		// Lane n's field of every component
+		inline unsigned char* GetLane(size_t lane)
+		{
+			return const_cast<unsigned char*>(static_cast<const SoABuffer*>(this)->GetLane(lane));
+		}
+
+		inline const unsigned char* GetLane(size_t lane) const
+		{
+			const auto& lanes = detail::GetFieldLanes<T>();
+			size_t offset = 0;
+
+			for (size_t n = 0; n < lane; n++)
+				offset += AlignLaneSize(lanes[n].Size * mLaneCapacity);
+
+			return LaneBase() + offset;
+		}
+
+		// Returns the lane holding the specified field (&T::Field) or null if it isn't one of the listed fields
+		template<typename M>
+		inline M* GetField(M T::* field)
+		{
+			return const_cast<M*>(static_cast<const SoABuffer*>(this)->GetField(field));
+		}
+
+		template<typename M>
+		inline const M* GetField(M T::* field) const
+		{
+			const auto& lanes = detail::GetFieldLanes<T>();
+			size_t offset = detail::GetFieldOffset(field);
+
+			for (size_t n = 0; n < lanes.size(); n++)
+			{
+				if (lanes[n].Offset == offset)
+					return reinterpret_cast<const M*>(GetLane(n));
+			}
+
+			return nullptr;
+		}
+
+		void reserve(size_t count)
+		{
+			mComponents.reserve(count);
+			ReserveLanes(count);
+		}
+
+		// New components (and their fields) are unspecified until they're stored to
+		void resize(size_t count)
+		{
+			mComponents.resize(count);
+			ReserveLanes(count);
+		}
+
+		inline void clear()
+		{
+			mComponents.clear();
+		}
+
+		iterator insert(const_iterator position, const T& component)
+		{
+			size_t index = std::distance(mComponents.cbegin(), position);
+
+			mComponents.insert(position, component);
+			ReserveLanes(mComponents.size());
+			CopyLanes(*this, index + 1, index, mComponents.size() - index - 1);
+			ScatterFields(index, component);
+			return mComponents.begin() + index;
+		}
+
+		void swap(SoABuffer& other)
+		{
+			mComponents.swap(other.mComponents);
+			mLaneStorage.swap(other.mLaneStorage);
+			std::swap(mLaneCapacity, other.mLaneCapacity);
+		}
+
+		// Copies count components' fields from source's lanes, the ranges may overlap
+		void CopyLanes(const SoABuffer& source, size_t index, size_t source_index, size_t count)
+		{
+			const auto& lanes = detail::GetFieldLanes<T>();
+
+			if (count == 0)
+				return;
+
+			for (size_t n = 0; n < lanes.size(); n++)
+				memmove(GetLane(n) + index * lanes[n].Size, source.GetLane(n) + source_index * lanes[n].Size, count * lanes[n].Size);
+		}
+
+		void ScatterFields(size_t index, const T& component)
+		{
+			const auto& lanes = detail::GetFieldLanes<T>();
+
+			for (size_t n = 0; n < lanes.size(); n++)
+				memcpy(GetLane(n) + index * lanes[n].Size, reinterpret_cast<const unsigned char*>(&component) + lanes[n].Offset, lanes[n].Size);
+		}
+
+		void GatherFields(size_t index, T& component) const
+		{
+			const auto& lanes = detail::GetFieldLanes<T>();
+
+			for (size_t n = 0; n < lanes.size(); n++)
+				memcpy(reinterpret_cast<unsigned char*>(&component) + lanes[n].Offset, GetLane(n) + index * lanes[n].Size, lanes[n].Size);
+		}
+	private:
+		static inline size_t AlignLaneSize(size_t size)
+		{
+			return (size + kLaneAlignment - 1) & ~(kLaneAlignment - 1);
+		}
+
+		inline const unsigned char* LaneBase() const
+		{
+			std::uintptr_t address = reinterpret_cast<std::uintptr_t>(mLaneStorage.data());
+			return mLaneStorage.data() + (AlignLaneSize(address) - address);
+		}
+
+		// Grows the lanes to hold at least count fields each, keeping the fields they hold
+		void ReserveLanes(size_t count)
+		{
+			if (count <= mLaneCapacity)
+				return;
+
+			const auto& lanes = detail::GetFieldLanes<T>();
+			SoABuffer grown;
+			size_t bytes = kLaneAlignment;
+
+			grown.mLaneCapacity = std::max(count, mLaneCapacity * 2);
+
+			for (auto& lane : lanes)
+				bytes += AlignLaneSize(lane.Size * grown.mLaneCapacity);
+
+			grown.mLaneStorage.resize(bytes);
+			grown.CopyLanes(*this, 0, 0, std::min(mComponents.size(), mLaneCapacity));
+			mLaneStorage.swap(grown.mLaneStorage);
+			mLaneCapacity = grown.mLaneCapacity;
+		}
+	};
+
+	// Copies count components from source[source_index] on to buffer[index], the ranges may overlap
+	template<typename T, typename Allocator>
+	inline void CopyComponentRange(std::vector<T, Allocator>& buffer, size_t index, const std::vector<T, Allocator>& source, size_t source_index, size_t count)
+	{
+		if (count > 0)
+			memmove(buffer.data() + index, source.data() + source_index, sizeof(T) * count);
+	}
+
+	template<typename T, typename Allocator>
+	inline void CopyComponentRange(SoABuffer<T, Allocator>& buffer, size_t index, const SoABuffer<T, Allocator>& source, size_t source_index, size_t count)
+	{
+		if (count > 0)
+		{
+			memmove(buffer.data() + index, source.data() + source_index, sizeof(T) * count);
+			buffer.CopyLanes(source, index, source_index, count);
+		}
+	}
+
+	// Overwrites buffer[index] with a whole component
+	template<typename T, typename Allocator>
+	inline void StoreComponentAt(std::vector<T, Allocator>& buffer, size_t index, const T& component)
+	{
+		buffer[index] = component;
+	}
+
+	template<typename T, typename Allocator>
+	inline void StoreComponentAt(SoABuffer<T, Allocator>& buffer, size_t index, const T& component)
+	{
+		buffer[index] = component;
+		buffer.ScatterFields(index, component);
+	}
+
+	// Returns a copy of the whole component at buffer[index]
+	template<typename T, typename Allocator>
+	inline T LoadComponentAt(const std::vector<T, Allocator>& buffer, size_t index)
+	{
+		return buffer[index];
+	}
+
+	template<typename T, typename Allocator>
+	inline T LoadComponentAt(const SoABuffer<T, Allocator>& buffer, size_t index)
+	{
+		T component = buffer[index];
+		buffer.GatherFields(index, component);
+		return component;
+	}
+
+	template<typename T, typename Allocator = std::allocator<T>>
 	struct ComponentContainer {
+		static_assert(!component_traits<T>::soa || !component_traits<T>::needs_destroy, "Components with SoA fields can't have a Destroy() member.");
+		static_assert(!component_traits<T>::soa || !T::HasCustomMigrationHandling, "Components with SoA fields can't use custom migration handling.");
+
 		using value_type = T;
+		// Components listing SoA fields store them in separate lanes, see SoABuffer
+		using BufferType = typename std::conditional<component_traits<T>::soa, SoABuffer<T, Allocator>, std::vector<T, Allocator>>::type;
+
+		BufferType PresentBuffer;
+		BufferType FutureBuffer;
+
+		// Entity index -> first component slot in the matching buffer, only maintained for component
+		// types using sparse sets. An empty lookup means it's outdated and must not be used.
+		std::vector<size_t> PresentLookup;
+		std::vector<size_t> FutureLookup;
 
-		std::vector<T> PresentBuffer;
-		std::vector<T> FutureBuffer;
+		// Types which had no pending actions and no authority requests during a tick keep an outdated future
+		// buffer and aren't swapped, which is equivalent to copying the present buffer over and swapping.
+		std::atomic<FutureBufferState> FutureState{ FutureBufferState::Outdated };
+
+		// Components are grouped in blocks of roughly a page. A dirty block may differ between both buffers, this
+		// relation is symmetric so it survives swaps. Structural changes to either buffer mark every block dirty.
+		static const size_t kDirtyBlockSize = (sizeof(T) >= 4096) ? 1 : (4096 / sizeof(T));
+
+		std::unique_ptr<std::atomic<unsigned char>[]> DirtyBlocks;
+		size_t DirtyBlockCount = 0;
+		size_t DirtyBlockCapacity = 0;
+		bool AllBlocksDirty = true;
+
+		// Versions at which each entity's components were last written or added (see BasicWorld's Changed<T> and
+		// Added<T> filters)
+		ComponentVersionTable ChangedVersions;
+		ComponentVersionTable AddedVersions;
+
+		inline bool IsFutureSynced() const
+		{
+			return FutureState.load(std::memory_order_acquire) == FutureBufferState::Synced;
+		}
+
+		// Returns the buffer processes write to. Single buffered types are written to in place, while outdated
+		// future buffers are structurally identical to the present buffer so the latter is returned until synced.
+		inline BufferType& GetFutureBuffer()
+		{
+			return (component_traits<T>::single_buffered || !IsFutureSynced()) ? PresentBuffer : FutureBuffer;
+		}
+
+		inline const BufferType& GetFutureBuffer() const
+		{
+			return (component_traits<T>::single_buffered || !IsFutureSynced()) ? PresentBuffer : FutureBuffer;
+		}
+
+		// Brings the future buffer up to date with the present buffer if needed. Threadsafe, concurrent callers
+		// wait for the first one to finish copying.
+		void SyncFutureBuffer()
+		{
+			if (component_traits<T>::single_buffered || IsFutureSynced())
+				return;
+
+			auto expected = FutureBufferState::Outdated;
+
+			if (FutureState.compare_exchange_strong(expected, FutureBufferState::Syncing, std::memory_order_acquire))
+			{
+				if (AllBlocksDirty || (FutureBuffer.size() != PresentBuffer.size()))
+				{
+					FutureBuffer = PresentBuffer;
+					FutureLookup = PresentLookup;
+				}
+				else
+				{
+					for (size_t block = 0; block < DirtyBlockCount; block++)
+					{
+						if (DirtyBlocks[block].load(std::memory_order_relaxed))
+						{
+							size_t first = block * kDirtyBlockSize;
+							size_t count = (first + kDirtyBlockSize > PresentBuffer.size()) ? PresentBuffer.size() - first : kDirtyBlockSize;
+							CopyComponentRange(FutureBuffer, first, PresentBuffer, first, count);
+						}
+					}
+				}
+
+				ResetDirtyBlocks(false);
+				FutureState.store(FutureBufferState::Synced, std::memory_order_release);
+			}
+			else
+			{
+				while (!IsFutureSynced())
+					std::this_thread::yield();
+			}
+		}
+
+		// Records a write to the future buffer, only valid while it's synced
+		inline void MarkFutureDirty(size_t index)
+		{
+			if (!component_traits<T>::single_buffered)
+			{
+				auto& block = DirtyBlocks[index / kDirtyBlockSize];
+
+				if (!block.load(std::memory_order_relaxed))
+					block.store(1, std::memory_order_relaxed);
+			}
+		}
+
+		// Records writes to a range of the future buffer, only valid while it's synced
+		inline void MarkFutureRangeDirty(size_t first, size_t count)
+		{
+			if (!component_traits<T>::single_buffered && (count > 0))
+			{
+				for (size_t block = first / kDirtyBlockSize; block <= (first + count - 1) / kDirtyBlockSize; block++)
+					DirtyBlocks[block].store(1, std::memory_order_relaxed);
+			}
+		}
+
+		// Stamps the owners of a range of future buffer components as changed at version
+		inline void MarkRangeChanged(size_t first, size_t count, unsigned version)
+		{
+			const auto& buffer = GetFutureBuffer();
+
+			for (size_t n = first; n < first + count; n++)
+				ChangedVersions.Mark(buffer[n].OwnerIndex, version);
+		}
+
+		// Clears the dirty blocks and resizes them to match the future buffer
+		void ResetDirtyBlocks(bool allDirty)
+		{
+			DirtyBlockCount = (FutureBuffer.size() + kDirtyBlockSize - 1) / kDirtyBlockSize;
+
+			if (DirtyBlockCount > DirtyBlockCapacity)
+			{
+				DirtyBlockCapacity = std::max(DirtyBlockCount, DirtyBlockCapacity * 2);
+				DirtyBlocks.reset(new std::atomic<unsigned char>[DirtyBlockCapacity]);
+			}
+
+			for (size_t block = 0; block < DirtyBlockCount; block++)
+				DirtyBlocks[block].store(0, std::memory_order_relaxed);
+
+			AllBlocksDirty = allDirty;
+		}
 	};
+
+	// Returns the first slot at or after cursor holding a component of entity_index or of a following entity, in a
+	// buffer sorted by OwnerIndex. Nearby slots are probed linearly and farther ones are galloped to, so visiting
+	// entities in increasing order walks the buffer like a merge join instead of searching all of it every time.
+	template<typename T>
+	inline size_t SeekComponentOwner(const T* data, size_t size, size_t cursor, size_t entity_index)
+	{
+		for (size_t probe = 0; probe < 4; probe++, cursor++)
+		{
+			if ((cursor >= size) || (data[cursor].OwnerIndex >= entity_index))
+				return cursor;
+		}
+
+		size_t low = cursor;
+		size_t high = cursor;
+
+		for (size_t step = 8;; step *= 2)
+		{
+			high = low + step;
+
+			if (high >= size)
+			{
+				high = size;
+				break;
+			}
+			else if (data[high].OwnerIndex >= entity_index)
+				break;
+
+			low = high + 1;
+		}
+
+		return std::distance(data, std::lower_bound(data + low, data + high, entity_index, [](const T& component, size_t index) {
+			return component.OwnerIndex < index;
+		}));
+	}
+
+	// Rebuilds the entity index -> first component slot lookup of a buffer sorted by OwnerIndex
+	template<typename BufferType>
+	void RebuildComponentLookup(const BufferType& buffer, std::vector<size_t>& lookup)
+	{
+		lookup.assign(buffer.empty() ? 0 : buffer.back().OwnerIndex + 1, kInvalidComponentSlot);
+
+		for (size_t n = buffer.size(); n-- > 0;)
+			lookup[buffer[n].OwnerIndex] = n;
+	}
 }
\ No newline at end of file
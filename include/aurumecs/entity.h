@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <type_traits>
 
 namespace au {
@@ -7,6 +8,33 @@ namespace au {
 	static const size_t kInvalidEntityGuid = 0;
 	static const size_t kInvalidEntityIndex = 0xFFFFFFFF;
 
+	// Entity guids are generational handles. The low bits contain the entity's slot index (offset by one
+	// so that a valid guid never equals kInvalidEntityGuid) and the high bits contain the slot's generation,
+	// which is bumped whenever the slot is reused so that guids belonging to removed entities stop resolving.
+	static const size_t kEntityGuidIndexBits = (sizeof(size_t) > 4) ? 32 : 24;
+	static const size_t kEntityGuidIndexMask = (size_t(1) << kEntityGuidIndexBits) - 1;
+
+	inline size_t MakeEntityGuid(size_t index, size_t generation)
+	{
+		return (generation << kEntityGuidIndexBits) | ((index + 1) & kEntityGuidIndexMask);
+	}
+
+	inline size_t GetEntityGuidIndex(size_t guid)
+	{
+		return (guid & kEntityGuidIndexMask) - 1;
+	}
+
+	inline size_t GetEntityGuidGeneration(size_t guid)
+	{
+		return guid >> kEntityGuidIndexBits;
+	}
+
+	// Number of 64 bit words holding one presence bit per component type
+	template<size_t componentCount>
+	struct component_bit_words {
+		static const size_t value = (componentCount + 63) / 64;
+	};
+
 	template<size_t componentCount>
 	struct EntityBase {
 		size_t Guid;
@@ -15,6 +43,9 @@ namespace au {
 		unsigned char ComponentCount[componentCount];
 		unsigned char InternalComponentCount[componentCount];
 
+		// Bit n is set when ComponentCount[n] isn't 0, so queries can match every component type at once
+		std::uint64_t ComponentBits[component_bit_words<componentCount>::value];
+
 		static_assert(sizeof(decltype(InternalComponentCount)) == sizeof(decltype(ComponentCount)), "Component count sizes must match");
 	};
 
@@ -1,18 +1,148 @@
 #pragma once
 
 #include <thread>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include <utility>
 #include <vector>
 #include "iprocess.h"
+#include "sync.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <cstdio>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace au {
-	// A dispatcher that executes processes over (NumThreads + 1) threads.
+	namespace detail {
+		// Returns the CPUs the process is allowed to run on
+		inline std::vector<int> GetProcessCpus()
+		{
+			std::vector<int> cpus;
+
+#ifdef _WIN32
+			DWORD_PTR process_mask = 0;
+			DWORD_PTR system_mask = 0;
+
+			if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+			{
+				for (int cpu = 0; cpu < (int) (sizeof(DWORD_PTR) * 8); cpu++)
+				{
+					if (process_mask & (DWORD_PTR(1) << cpu))
+						cpus.push_back(cpu);
+				}
+			}
+#elif defined(__linux__)
+			cpu_set_t set;
+			CPU_ZERO(&set);
+
+			if (sched_getaffinity(0, sizeof(set), &set) == 0)
+			{
+				for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+				{
+					if (CPU_ISSET(cpu, &set))
+						cpus.push_back(cpu);
+				}
+			}
+#endif
+
+			if (cpus.empty())
+			{
+				for (int cpu = 0; cpu < (int) std::max(1u, std::thread::hardware_concurrency()); cpu++)
+					cpus.push_back(cpu);
+			}
+
+			return cpus;
+		}
+
+		// Returns the NUMA node a CPU belongs to, 0 when unknown
+		inline int GetCpuNumaNode(int cpu)
+		{
+#ifdef _WIN32
+			UCHAR node = 0;
+
+			if ((cpu < 256) && GetNumaProcessorNode((UCHAR) cpu, &node) && (node != 0xFF))
+				return node;
+#elif defined(__linux__)
+			// Linux links every CPU to its node as /sys/devices/system/cpu/cpuN/nodeM
+			char path[64];
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+			if (DIR* dir = opendir(path))
+			{
+				int node = 0;
+
+				while (dirent* entry = readdir(dir))
+				{
+					if (sscanf(entry->d_name, "node%d", &node) == 1)
+						break;
+				}
+
+				closedir(dir);
+				return node;
+			}
+#endif
+			return 0;
+		}
+
+		// Pins the calling thread to a single CPU, returns whether it succeeded
+		inline bool PinCurrentThread(int cpu)
+		{
+#ifdef _WIN32
+			if (cpu >= (int) (sizeof(DWORD_PTR) * 8))
+				return false;
+
+			return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#elif defined(__linux__)
+			if (cpu >= CPU_SETSIZE)
+				return false;
+
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+			return false;
+#endif
+		}
+	}
+
+	/// Construction options of a ThreadPoolDispatcher.
+	struct DispatcherOptions {
+		/// Worker threads to create, on top of the thread calling Execute(). Negative counts create one thread per
+		/// CPU in Cpus (or per CPU the process may run on when Cpus is empty), minus the calling thread.
+		int WorkerCount = -1;
+
+		/// CPUs the dispatcher's threads run on. The worker with thread index n is pinned to Cpus[n], wrapping
+		/// around, which leaves Cpus[0] to the thread calling Execute(). An empty list doesn't pin workers unless
+		/// PinThreads is set, in which case it stands for every CPU the process may run on.
+		std::vector<int> Cpus;
+		bool PinThreads = false;
+
+		/// Orders Cpus by NUMA node before pinning, so neighbouring thread indices share a node. Component memory
+		/// isn't bound to nodes, the dispatcher only controls where its threads run.
+		bool GroupByNumaNode = false;
+	};
+
+	// A dispatcher that executes processes over a number of threads chosen at construction (the calling thread and
+	// DispatcherOptions::WorkerCount workers), optionally pinned to CPUs.
 	// Note that using this with very small worlds and short processes may
 	// lead to slowdowns since there's a slight overhead.
-	template<int NumThreads>
-	class MultiThreadedDispatcher {
-		static_assert(NumThreads > 0, "Must use more at least two threads (including the spawning thread) for a MultiThreadedDispatcher");
-		static_assert(NumThreads < 32, "Probably a bad idea to use more than 32 threads in a MultiThreadedDispatcher");
+	// Between calls to Execute() the worker threads spin for SpinDuration(), so back to back batches start right
+	// away, and then park until the next batch is published. Idle worlds don't use any CPU time.
+	class ThreadPoolDispatcher {
 	private:
 		// Note: This is a slight hack since atomics are not copy-constructible/copy-assignable (and for good reason).
 		// The wrapper just lets us contain atomics in an std::vector. This usage is safe since in this situation
@@ -33,32 +163,95 @@ namespace au {
 			AtomicCopyWrapper<std::atomic_bool> done;
 		};
 
+		// Chunked loop published by a thread from inside a process so that idle threads can help with it. Every
+		// dispatcher thread owns the slot matching its thread index.
+		struct ParallelJob {
+			void(*Callback)(void*, size_t) = nullptr;
+			void* Context = nullptr;
+			size_t ChunkCount = 0;
+			std::atomic<size_t> NextChunk{ 0 };
+			std::atomic<size_t> CompletedChunks{ 0 };
+			std::atomic<int> Helpers{ 0 };
+			std::atomic_bool Active{ false };
+		};
+
 		double mTimeSec = 0.0;
-		std::thread mThreads[NumThreads];
-		std::atomic_bool mThreadActive[NumThreads];
+		std::unique_ptr<ParallelJob[]> mParallelJobs;
+		std::vector<std::thread> mThreads;
+		std::vector<int> mThreadCpus;
 		std::vector<ScheduledProcess> mScheduledProcesses;
 		std::atomic_bool mExecuting = false;
-		std::atomic_bool mStopRequested = false;
+		std::atomic<int> mActiveWorkers{ 0 };
+		detail::BatchSignal mBatchSignal;
+
+		// Dispatcher the calling thread belongs to and its index there, threads that don't belong to any use 0
+		struct ThreadIdentity {
+			const ThreadPoolDispatcher* Owner = nullptr;
+			int Index = 0;
+		};
+
+		static inline ThreadIdentity& GetThreadIdentity()
+		{
+			static thread_local ThreadIdentity identity;
+			return identity;
+		}
 	public:
-		MultiThreadedDispatcher()
+		// How long workers keep spinning for a new batch before parking
+		static constexpr std::chrono::microseconds SpinDuration()
 		{
+			return std::chrono::microseconds(200);
+		}
+
+		explicit ThreadPoolDispatcher(const DispatcherOptions& options = DispatcherOptions())
+		{
+			std::vector<int> cpus = options.Cpus;
+
+			if (cpus.empty() && ((options.WorkerCount < 0) || options.PinThreads))
+				cpus = detail::GetProcessCpus();
+
+			if (options.GroupByNumaNode)
+			{
+				// Looking nodes up hits the OS, so it's done once per CPU rather than per comparison
+				std::vector<std::pair<int, int>> nodes;
+
+				for (int cpu : cpus)
+					nodes.emplace_back(detail::GetCpuNumaNode(cpu), cpu);
+
+				std::stable_sort(nodes.begin(), nodes.end(), [](const std::pair<int, int>& lhs, const std::pair<int, int>& rhs) {
+					return lhs.first < rhs.first;
+				});
+
+				for (size_t n = 0; n < nodes.size(); n++)
+					cpus[n] = nodes[n].second;
+			}
+
+			int worker_count = (options.WorkerCount >= 0) ? options.WorkerCount : std::max(0, (int) cpus.size() - 1);
+
+			mParallelJobs.reset(new ParallelJob[worker_count + 1]);
 			mScheduledProcesses.reserve(10);
 
-			for (int n = 0; n < NumThreads; n++)
-				mThreads[n] = std::thread(ThreadExecutionCallback, this, n);
+			// Thread index 0 is the calling thread, which is left alone
+			if (options.PinThreads || !options.Cpus.empty())
+			{
+				for (int n = 0; n <= worker_count; n++)
+					mThreadCpus.push_back(cpus[n % cpus.size()]);
+			}
+
+			for (int n = 0; n < worker_count; n++)
+				mThreads.emplace_back(ThreadExecutionCallback, this, n);
 		}
 
-		~MultiThreadedDispatcher()
+		~ThreadPoolDispatcher()
 		{
-			mStopRequested = true;
+			mBatchSignal.Stop();
 
-			for (int n = 0; n < NumThreads; n++)
-				mThreads[n].join();
+			for (auto& thread : mThreads)
+				thread.join();
 		}
 
-		MultiThreadedDispatcher(const MultiThreadedDispatcher&) = delete;
-		MultiThreadedDispatcher(MultiThreadedDispatcher&&) = delete;
-		MultiThreadedDispatcher& operator=(const MultiThreadedDispatcher&) = delete;
+		ThreadPoolDispatcher(const ThreadPoolDispatcher&) = delete;
+		ThreadPoolDispatcher(ThreadPoolDispatcher&&) = delete;
+		ThreadPoolDispatcher& operator=(const ThreadPoolDispatcher&) = delete;
 
 		inline void Schedule(IProcess* process)
 		{
@@ -71,12 +264,14 @@ namespace au {
 
 		void Execute()
 		{
-			auto size = mScheduledProcesses.size();
+			detail::Backoff backoff;
 			mExecuting = true;
+			mBatchSignal.Publish();
 
 			bool any_not_done = true;
 			while (any_not_done)
 			{
+				bool progressed = false;
 				any_not_done = false;
 
 				for (ScheduledProcess& schedule : mScheduledProcesses)
@@ -86,49 +281,141 @@ namespace au {
 					{
 						schedule.process->Execute(mTimeSec);
 						schedule.done.a = true;
+						progressed = true;
 					}
 					else if (!schedule.done.a)
 					{
 						any_not_done = true;
 					}
 				}
+
+				if (HelpParallelJobs() || progressed)
+					backoff.Reset();
+				else if (any_not_done)
+					backoff.Pause();
 			}
 
+			// Workers check mExecuting after registering as active, so none of them can start looking at the
+			// scheduled processes once this sees no active workers
 			mExecuting = false;
+			backoff.Reset();
 
-			while (true)
-			{
-				bool any_executing = false;
+			while (mActiveWorkers != 0)
+				backoff.Pause();
 
-				for (int n = 0; n < NumThreads; n++)
-				{
-					if (mThreadActive[n])
-					{
-						any_executing = true;
-						break;
-					}
-				}
+			mScheduledProcesses.clear();
+		}
 
-				if (!any_executing)
-					break;
-			}
+		/// Calls callback(context, chunk) for every chunk < chunk_count, spread over the calling thread and every
+		/// dispatcher thread that's idle or done with its processes. Returns once all chunks are done. Meant to be
+		/// called from inside processes, the callback must not throw nor call ParallelFor itself.
+		void ParallelFor(size_t chunk_count, void(*callback)(void*, size_t), void* context)
+		{
+			ParallelJob& job = mParallelJobs[GetCurrentThreadIndex()];
 
-			mScheduledProcesses.clear();
+			job.Callback = callback;
+			job.Context = context;
+			job.ChunkCount = chunk_count;
+			job.NextChunk = 0;
+			job.CompletedChunks = 0;
+			job.Active = true;
+
+			RunParallelChunks(job);
+
+			detail::Backoff backoff;
+
+			while (job.CompletedChunks.load(std::memory_order_acquire) != chunk_count)
+				backoff.Pause();
+
+			// Helpers that joined late may still be looking at the job
+			job.Active = false;
+
+			while (job.Helpers != 0)
+				backoff.Pause();
 		}
 
 		inline void SetTime(double timeSec)
 		{
 			mTimeSec = timeSec;
 		}
+
+		inline int GetThreadCount() const
+		{
+			return (int) mThreads.size() + 1;
+		}
+
+		// Returns the index of the dispatcher thread the caller is running on, the thread
+		// that calls Execute() is always index 0 and worker threads use 1 to GetThreadCount() - 1.
+		// NOTE: Only meaningful when called from this dispatcher's threads.
+		inline int GetCurrentThreadIndex() const
+		{
+			const ThreadIdentity& identity = GetThreadIdentity();
+			return (identity.Owner == this) ? identity.Index : 0;
+		}
+
+		// Returns the CPU a thread index is pinned to, or -1 if it isn't. The thread calling Execute() is never
+		// pinned by the dispatcher, its entry is the CPU it's expected to run on.
+		inline int GetThreadCpu(int index) const
+		{
+			return mThreadCpus.empty() ? -1 : mThreadCpus[index];
+		}
 	private:
-		static void ThreadExecutionCallback(MultiThreadedDispatcher<NumThreads>* owner, int tindex)
+		// Returns whether any chunk was run
+		static bool RunParallelChunks(ParallelJob& job)
+		{
+			size_t chunk;
+			bool ran = false;
+
+			while ((chunk = job.NextChunk.fetch_add(1)) < job.ChunkCount)
+			{
+				job.Callback(job.Context, chunk);
+				job.CompletedChunks.fetch_add(1, std::memory_order_release);
+				ran = true;
+			}
+
+			return ran;
+		}
+
+		// Returns whether any chunk was run
+		bool HelpParallelJobs()
 		{
-			while (!owner->mStopRequested)
+			bool helped = false;
+
+			for (size_t n = 0; n < mThreads.size() + 1; n++)
+			{
+				ParallelJob& job = mParallelJobs[n];
+
+				if (!job.Active)
+					continue;
+
+				// The job's fields are only valid if it's still active once registered as a helper
+				job.Helpers++;
+
+				if (job.Active)
+					helped = RunParallelChunks(job) || helped;
+
+				job.Helpers--;
+			}
+
+			return helped;
+		}
+
+		static void ThreadExecutionCallback(ThreadPoolDispatcher* owner, int tindex)
+		{
+			GetThreadIdentity().Owner = owner;
+			GetThreadIdentity().Index = tindex + 1;
+			unsigned batch = 0;
+
+			if (!owner->mThreadCpus.empty())
+				detail::PinCurrentThread(owner->mThreadCpus[tindex + 1]);
+
+			while (owner->mBatchSignal.Wait(batch, SpinDuration()))
 			{
+				owner->mActiveWorkers++;
+
+				// The batch may already be over, its processes must not be looked at then
 				if (owner->mExecuting)
 				{
-					owner->mThreadActive[tindex] = true;
-
 					for (ScheduledProcess& schedule : owner->mScheduledProcesses)
 					{
 						bool expected = false;
@@ -138,13 +425,39 @@ namespace au {
 							schedule.done.a = true;
 						}
 					}
+
+					// Parallel loops are only started by processes, so help with them until the batch is over
+					detail::Backoff backoff;
+
+					while (owner->mExecuting)
+					{
+						if (owner->HelpParallelJobs())
+							backoff.Reset();
+						else
+							backoff.Pause();
+					}
 				}
-				else
-				{
-					owner->mThreadActive[tindex] = false;
-					std::this_thread::yield();
-				}
+
+				owner->mActiveWorkers--;
 			}
 		}
 	};
+
+	// A ThreadPoolDispatcher running processes over (NumThreads + 1) unpinned threads.
+	template<int NumThreads>
+	class MultiThreadedDispatcher : public ThreadPoolDispatcher {
+		static_assert(NumThreads > 0, "Must use more at least two threads (including the spawning thread) for a MultiThreadedDispatcher");
+		static_assert(NumThreads < 32, "Probably a bad idea to use more than 32 threads in a MultiThreadedDispatcher, use a ThreadPoolDispatcher instead");
+
+		static DispatcherOptions MakeOptions()
+		{
+			DispatcherOptions options;
+			options.WorkerCount = NumThreads;
+			return options;
+		}
+	public:
+		MultiThreadedDispatcher() : ThreadPoolDispatcher(MakeOptions())
+		{
+		}
+	};
 }
\ No newline at end of file
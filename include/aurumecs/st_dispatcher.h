@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include "iprocess.h"
 
 namespace au {
@@ -17,9 +18,25 @@ namespace au {
 
 		}
 
+		inline void ParallelFor(size_t chunk_count, void(*callback)(void*, size_t), void* context)
+		{
+			for (size_t chunk = 0; chunk < chunk_count; chunk++)
+				callback(context, chunk);
+		}
+
 		inline void SetTime(double timeSec)
 		{
 			mTimeSec = timeSec;
 		}
+
+		inline int GetThreadCount() const
+		{
+			return 1;
+		}
+
+		inline int GetCurrentThreadIndex() const
+		{
+			return 0;
+		}
 	};
 }
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#endif
+
+namespace au {
+	namespace detail {
+		// Tells the CPU the caller is spinning, which frees resources for its sibling hyperthread
+		inline void CpuRelax()
+		{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+			_mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+			__builtin_ia32_pause();
+#elif defined(__aarch64__)
+			asm volatile("yield");
+#endif
+		}
+
+		// Waits spin for a bounded number of rounds before yielding their time slice on every round
+		class Backoff {
+			static const int kSpinRounds = 64;
+			int mRounds = 0;
+		public:
+			inline void Pause()
+			{
+				if (mRounds < kSpinRounds)
+				{
+					mRounds++;
+					CpuRelax();
+				}
+				else
+					std::this_thread::yield();
+			}
+
+			inline void Reset()
+			{
+				mRounds = 0;
+			}
+		};
+
+		// Lets a dispatcher's worker threads wait for the batches of work published by the thread calling Execute().
+		// Waiting threads spin for a while before parking, so back to back batches start right away while idle
+		// threads don't use any CPU time.
+		class BatchSignal {
+			std::atomic<unsigned> mBatch{ 0 };
+			std::atomic<int> mParkedThreads{ 0 };
+			std::atomic_bool mStopped{ false };
+			std::mutex mParkMutex;
+			std::condition_variable mParkCondition;
+		public:
+			// Wakes waiting threads up to work on a new batch
+			inline void Publish()
+			{
+				mBatch++;
+				WakeParkedThreads();
+			}
+
+			// Wakes waiting threads up for good, Wait() returns false from then on
+			inline void Stop()
+			{
+				mStopped = true;
+				WakeParkedThreads();
+			}
+
+			inline bool IsStopped() const
+			{
+				return mStopped;
+			}
+
+			// Waits for a batch other than the last one seen, spinning for spinDuration before parking. Returns false
+			// once stopped.
+			bool Wait(unsigned& batch, std::chrono::microseconds spinDuration)
+			{
+				auto spin_end = std::chrono::steady_clock::now() + spinDuration;
+				Backoff backoff;
+
+				while ((mBatch == batch) && !mStopped)
+				{
+					if (std::chrono::steady_clock::now() >= spin_end)
+					{
+						std::unique_lock<std::mutex> lock(mParkMutex);
+						mParkedThreads++;
+						mParkCondition.wait(lock, [&] { return (mBatch != batch) || mStopped; });
+						mParkedThreads--;
+						break;
+					}
+
+					backoff.Pause();
+				}
+
+				batch = mBatch;
+				return !mStopped;
+			}
+		private:
+			void WakeParkedThreads()
+			{
+				// A thread about to park either registered before this check, in which case it's notified under the
+				// lock, or it re-checks the batch and stop flag after this point and won't park at all
+				if (mParkedThreads != 0)
+				{
+					std::lock_guard<std::mutex> lock(mParkMutex);
+					mParkCondition.notify_all();
+				}
+			}
+		};
+	}
+}
\ No newline at end of file
@@ -36,7 +36,7 @@ namespace au {
 			};
 
 			template <typename ActionType>
-			static void for_each(ActionType& action, std::size_t pos_index = 0)
+			static void for_each(ActionType&, std::size_t = 0)
 			{
 			}
 		};
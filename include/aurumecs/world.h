@@ -4,28 +4,102 @@
 #include <stdexcept>
 #include <chrono>
 #include <cassert>
-#include <variant.h>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <bitset>
+#include <unordered_map>
+#include <utility>
 #include "iworld.h"
 #include "iprocess.h"
 #include "entity.h"
+#include "component.h"
 #include "component_container.h"
 #include "type_seqs.h"
 
 namespace au {
 	namespace detail {
-		struct RemovalAction {
-			size_t id;
-		};
+		// Order in which pending component actions are applied: by buffer index, then by owner index and guid. Buffers
+		// are sorted by owner index, so actions of different owners at the same index must follow that order too.
+		template<typename LhsAction, typename RhsAction>
+		inline bool ComponentActionPrecedes(const LhsAction& lhs, const RhsAction& rhs)
+		{
+			if (lhs.Index != rhs.Index)
+				return lhs.Index < rhs.Index;
 
-		template<typename... ComponentTypes>
-		struct ComponentChangeInfo {
-			size_t index;
-			size_t removeLength;
+			return (lhs.OwnerIndex < rhs.OwnerIndex) || ((lhs.OwnerIndex == rhs.OwnerIndex) && (lhs.OwnerGuid < rhs.OwnerGuid));
+		}
 
-			EntityBase<sizeof...(ComponentTypes)> owner;
-			variant<ComponentTypes..., RemovalAction> data;
-			bool destructive;
-		};
+		static const size_t kComponentActionKeyWords = 3;
+
+		// Sort key words of a pending action, least significant first. Ordering by owner index and then generation
+		// is the same as ordering by owner index and then guid: an entity index only belongs to a single slot at a
+		// time, whose guids differ by their generation alone.
+		template<typename Action>
+		inline size_t GetComponentActionKey(const Action& action, size_t word)
+		{
+			return (word == 0) ? GetEntityGuidGeneration(action.OwnerGuid) :
+				(word == 1) ? action.OwnerIndex : action.Index;
+		}
+
+		// Stable LSD radix sort of pending actions into ComponentActionPrecedes order, one byte per pass. Bytes above
+		// the highest bit used by a key word and bytes shared by every action are skipped, so a tick's actions are
+		// usually sorted in a handful of linear passes. Scratch is only used as temporary storage.
+		template<typename ActionVector>
+		void SortComponentActions(ActionVector& actions, ActionVector& scratch)
+		{
+			using Action = typename ActionVector::value_type;
+			const size_t count = actions.size();
+
+			if ((count < 2) || std::is_sorted(actions.begin(), actions.end(), ComponentActionPrecedes<Action, Action>))
+				return;
+
+			// Not worth the histogram passes
+			if (count < 64)
+			{
+				std::stable_sort(actions.begin(), actions.end(), ComponentActionPrecedes<Action, Action>);
+				return;
+			}
+
+			size_t used_bits[kComponentActionKeyWords] = {};
+			size_t histogram[256];
+
+			for (auto& action : actions)
+			{
+				for (size_t word = 0; word < kComponentActionKeyWords; word++)
+					used_bits[word] |= GetComponentActionKey(action, word);
+			}
+
+			scratch.resize(count);
+
+			for (size_t word = 0; word < kComponentActionKeyWords; word++)
+			{
+				for (size_t shift = 0; (shift < sizeof(size_t) * 8) && ((used_bits[word] >> shift) != 0); shift += 8)
+				{
+					memset(histogram, 0, sizeof(histogram));
+
+					for (auto& action : actions)
+						histogram[(GetComponentActionKey(action, word) >> shift) & 0xFF]++;
+
+					if (histogram[(GetComponentActionKey(actions[0], word) >> shift) & 0xFF] == count)
+						continue;
+
+					size_t offset = 0;
+					for (auto& bucket : histogram)
+					{
+						size_t bucket_size = bucket;
+						bucket = offset;
+						offset += bucket_size;
+					}
+
+					for (auto& action : actions)
+						scratch[histogram[(GetComponentActionKey(action, word) >> shift) & 0xFF]++] = action;
+
+					actions.swap(scratch);
+				}
+			}
+		}
 	}
 
 	class InvalidProcessStateException : public std::runtime_error {
@@ -72,6 +146,184 @@ namespace au {
 	template<typename... T>
 	using OptionalSet = type_tuple <T...>;
 
+	/// Selects T like a plain component type, but only visits the entities whose T changed since the previous
+	/// tick, which includes components that were just added.
+	template<typename T>
+	struct Changed {
+	};
+
+	/// Selects T like a plain component type, but only visits the entities that were given a T since the previous tick.
+	template<typename T>
+	struct Added {
+	};
+
+	/// Excludes the entities having any of T from an iterator's selection.
+	template<typename... T>
+	struct Without {
+	};
+
+	namespace detail {
+		template<typename T>
+		struct unwrap_change_filter {
+			using type = T;
+		};
+
+		template<typename T>
+		struct unwrap_change_filter<Changed<T>> {
+			using type = T;
+		};
+
+		template<typename T>
+		struct unwrap_change_filter<Added<T>> {
+			using type = T;
+		};
+
+		template<typename T>
+		using unwrap_change_filter_t = typename unwrap_change_filter<T>::type;
+
+		template<typename Set>
+		struct has_change_filters;
+
+		template<typename... T>
+		struct has_change_filters<type_tuple<T...>> : std::integral_constant<bool, !std::is_same<type_tuple<T...>, type_tuple<unwrap_change_filter_t<T>...>>::value> {
+		};
+
+		template<typename Lhs, typename Rhs>
+		struct concat_type_tuples;
+
+		template<typename... T, typename... U>
+		struct concat_type_tuples<type_tuple<T...>, type_tuple<U...>> {
+			using type = type_tuple<T..., U...>;
+		};
+
+		// Components an iterator selecting T... requires, without its filters
+		template<typename... T>
+		struct selected_components {
+			using type = type_tuple<>;
+		};
+
+		template<typename T, typename... R>
+		struct selected_components<T, R...> {
+			using type = typename concat_type_tuples<type_tuple<unwrap_change_filter_t<T>>, typename selected_components<R...>::type>::type;
+		};
+
+		template<typename... W, typename... R>
+		struct selected_components<Without<W...>, R...> {
+			using type = typename selected_components<R...>::type;
+		};
+
+		// Components excluded through the Without<> entries of T...
+		template<typename... T>
+		struct excluded_components {
+			using type = type_tuple<>;
+		};
+
+		template<typename T, typename... R>
+		struct excluded_components<T, R...> {
+			using type = typename excluded_components<R...>::type;
+		};
+
+		template<typename... W, typename... R>
+		struct excluded_components<Without<W...>, R...> {
+			using type = typename concat_type_tuples<type_tuple<W...>, typename excluded_components<R...>::type>::type;
+		};
+
+		// Whether every type of Sub is in Super, empty sets being subsets of anything
+		template<typename Sub, typename Super>
+		struct is_type_subset;
+
+		template<typename... T, typename... U>
+		struct is_type_subset<type_tuple<T...>, type_tuple<U...>> : std::integral_constant<bool, (sizeof...(T) == 0) || type_tuple<T...>::template is_subset_of<U...>::value> {
+		};
+
+		template<typename T, typename = void>
+		struct declared_authority_components : std::false_type {
+			using type = type_tuple<>;
+		};
+
+		template<typename T>
+		struct declared_authority_components<T, typename wrapper<typename T::AuthorityComponents>::type> : std::true_type {
+			using type = typename T::AuthorityComponents;
+		};
+
+		template<typename T, typename = void>
+		struct declared_read_components : std::false_type {
+			using type = type_tuple<>;
+		};
+
+		template<typename T>
+		struct declared_read_components<T, typename wrapper<typename T::ReadComponents>::type> : std::true_type {
+			using type = typename T::ReadComponents;
+		};
+
+		template<typename T, typename = void>
+		struct declared_optional_components : std::false_type {
+			using type = type_tuple<>;
+		};
+
+		template<typename T>
+		struct declared_optional_components<T, typename wrapper<typename T::OptionalComponents>::type> : std::true_type {
+			using type = typename T::OptionalComponents;
+		};
+
+		// Allocator honouring alignof(T) for over-aligned types, which operator new only does from C++17 on. Each
+		// allocation is padded to the alignment, the address returned by operator new is stored right before it.
+		template<typename T>
+		class OverAlignedAllocator {
+		public:
+			using value_type = T;
+
+			OverAlignedAllocator() = default;
+
+			template<typename U>
+			OverAlignedAllocator(const OverAlignedAllocator<U>&)
+			{
+			}
+
+			T* allocate(std::size_t count)
+			{
+				char* raw = static_cast<char*>(::operator new(count * sizeof(T) + sizeof(void*) + alignof(T) - 1));
+				std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*) + alignof(T) - 1) & ~std::uintptr_t(alignof(T) - 1);
+				reinterpret_cast<void**>(aligned)[-1] = raw;
+				return reinterpret_cast<T*>(aligned);
+			}
+
+			inline void deallocate(T* ptr, std::size_t)
+			{
+				::operator delete(reinterpret_cast<void**>(ptr)[-1]);
+			}
+
+			template<typename U>
+			inline bool operator==(const OverAlignedAllocator<U>&) const
+			{
+				return true;
+			}
+
+			template<typename U>
+			inline bool operator!=(const OverAlignedAllocator<U>&) const
+			{
+				return false;
+			}
+		};
+	}
+
+	/// Resolves the component access a process type declares through the following members:
+	///     using AuthorityComponents = AuthoritySet<...>;	// Components it has authority over
+	///     using ReadComponents = ComponentSet<...>;		// Components it only reads (filters are allowed)
+	///     using OptionalComponents = OptionalSet<...>;	// Components it reads or edits when present
+	/// Undeclared sets are empty. Processes declaring any of them are scheduled alongside the processes of other
+	/// groups they don't conflict with (see BasicWorld::AddProcess), so the declaration must cover every component
+	/// the process touches.
+	template<typename T>
+	struct process_traits {
+		using authority = typename detail::declared_authority_components<T>::type;
+		using reads = typename detail::declared_read_components<T>::type;
+		using optionals = typename detail::declared_optional_components<T>::type;
+
+		static const bool declares_access = detail::declared_authority_components<T>::value ||
+			detail::declared_read_components<T>::value || detail::declared_optional_components<T>::value;
+	};
+
 	class WorldMetricsBase {
 	public:
 		struct ComponentMetrics_t {
@@ -87,7 +339,7 @@ namespace au {
 		double EventHandlingTime = 0.0;
 		double TotalProcessTime = 0.0;
 
-		virtual ComponentMetrics_t GetComponentMetrics(size_t componentTypeIdx) const
+		virtual ComponentMetrics_t GetComponentMetrics(size_t) const
 		{
 			return{};
 		}
@@ -114,69 +366,333 @@ namespace au {
 		}
 	};
 
+	/// Storage policies of BasicWorld. Both keep every component type in its own ComponentContainer, sorted by owner.
+	/// ContainerStorage leaves each entity in the row of its guid's slot.
+	struct ContainerStorage {
+		static const bool clusters_archetypes = false;
+		static const size_t chunk_entities = 0;
+	};
+
+	/// ArchetypeStorage moves the entities sharing a component signature (their component counts) next to each
+	/// other at the start of every tick following structural changes, so the components of such an archetype form
+	/// parallel runs in every buffer. Runs are split in chunks of ChunkEntities entities which ForEach and
+	/// ParallelForEach sweep linearly, and iterators index them directly instead of searching for every entity.
+	/// Re-clustering moves the components whose owners changed rows, so it pays off for worlds whose entities
+	/// rarely change their component set. Entity indices (EntityRef::Index) change along with the rows, references
+	/// kept across ticks go through their guid (see EntityRef::Acquire).
+	template<size_t ChunkEntities = 1024>
+	struct ArchetypeStorage {
+		static_assert(ChunkEntities > 0, "Chunks must hold at least one entity.");
+
+		static const bool clusters_archetypes = true;
+		static const size_t chunk_entities = ChunkEntities;
+	};
+
 	// Core class of the ECS. Contains Entities, Components and Processes.
-	template<typename DispatcherType, typename... ComponentTypes>
-	class World : public IWorld {
+	// Component buffers and the world's other growing containers use AllocatorType (see aligned_arena.h), the
+	// layout of the entities and their components is chosen by StoragePolicy (ContainerStorage or ArchetypeStorage).
+	template<template<typename> class AllocatorType, typename DispatcherType, typename StoragePolicy, typename... ComponentTypes>
+	class BasicWorld : public IWorld {
+		// Runs a process on the dispatcher and keeps a moving average of its execution time, which TimeTaken() returns
+		class ProcessJob : public IProcess {
+			// Makes a command buffer the active one of a dispatcher thread and restores the previous one on destruction,
+			// so the thread's active buffer is right again even when the process throws
+			class ActiveCommandBufferScope {
+				size_t& mActiveBuffer;
+				size_t mPreviousBuffer;
+			public:
+				ActiveCommandBufferScope(size_t& active_buffer, size_t buffer) : mActiveBuffer(active_buffer), mPreviousBuffer(active_buffer)
+				{
+					mActiveBuffer = buffer;
+				}
+
+				~ActiveCommandBufferScope()
+				{
+					mActiveBuffer = mPreviousBuffer;
+				}
+
+				ActiveCommandBufferScope(const ActiveCommandBufferScope&) = delete;
+				ActiveCommandBufferScope& operator=(const ActiveCommandBufferScope&) = delete;
+			};
+
+			BasicWorld* mOwner;
+			IProcess* mProcess;
+			size_t mCommandBuffer = 0;
+			double mAverageTime = 0.0;
+			bool mTimed = false;
+		public:
+			// Weight of the latest execution in the moving average
+			static constexpr double kSmoothing = 0.125;
+
+			ProcessJob(BasicWorld* owner, IProcess* process) : mOwner(owner), mProcess(process)
+			{
+			}
+
+			void Execute(double timeSec) override
+			{
+				// Structural changes requested by the process are recorded in its own command buffer (see GetCommandBuffer)
+				std::chrono::duration<double> delta_time;
+				{
+					ActiveCommandBufferScope active_buffer(mOwner->mActiveCommandBuffers[mOwner->mDispatcher.GetCurrentThreadIndex()], mCommandBuffer);
+					auto start_time = std::chrono::high_resolution_clock::now();
+					mProcess->Execute(timeSec);
+					delta_time = std::chrono::high_resolution_clock::now() - start_time;
+				}
+
+				mAverageTime = mTimed ? mAverageTime + (delta_time.count() - mAverageTime) * kSmoothing : delta_time.count();
+				mTimed = true;
+			}
+
+			inline void SetCommandBuffer(size_t index)
+			{
+				mCommandBuffer = index;
+			}
+
+			inline double TimeTaken() const override
+			{
+				return mAverageTime;
+			}
+
+			inline size_t GetProcessTypeId() const override
+			{
+				return mProcess->GetProcessTypeId();
+			}
+
+			inline size_t GetProcessGroupId() const override
+			{
+				return mProcess->GetProcessGroupId();
+			}
+		};
+
 		struct ProcessData {
 			IProcess* Process;
 			bool Enabled;
+			bool DeclaresAccess;
+			std::bitset<sizeof...(ComponentTypes)> Writes;
+			std::bitset<sizeof...(ComponentTypes)> Reads;
+			std::unique_ptr<ProcessJob> Job;
 		};
 		struct AuthorityData {
 			bool Requested;
 			void* RequestSource;
 		};
+		struct EntitySlot {
+			size_t Generation;
+			// Index of the slot's entity in mEntities, the slot itself unless archetypes are clustered
+			size_t Row;
+		};
 	public:
 		using EntityType = EntityBase<sizeof...(ComponentTypes)>;
 		using MetricsType = WorldMetrics<sizeof...(ComponentTypes)>;
 	private:
-		using ComponentAction = detail::ComponentChangeInfo<ComponentTypes...>;
-		using ComponentStorage = std::tuple<ComponentContainer<ComponentTypes>...>;
+		template<typename T>
+		using Vector = std::vector<T, AllocatorType<T>>;
+		template<typename T>
+		using Container = ComponentContainer<T, AllocatorType<T>>;
+
+		// Pending structural changes for a single component type. Owners are referenced by guid, which encodes their
+		// slot, and by their entity index when the action was recorded, which only orders the actions. Additions
+		// carry the new component and nothing else.
+		template<typename T>
+		struct ComponentActionQueue {
+			struct Addition {
+				size_t Index;
+				size_t OwnerGuid;
+				size_t OwnerIndex;
+				T Data;
+			};
+
+			struct Removal {
+				size_t Index;
+				size_t Length;
+				size_t OwnerGuid;
+				size_t OwnerIndex;
+				bool Destructive;
+			};
+
+			Vector<Addition> Additions;
+			Vector<Removal> Removals;
+		};
+
+		using ComponentActionQueues = std::tuple<ComponentActionQueue<ComponentTypes>...>;
+		using ComponentStorage = std::tuple<Container<ComponentTypes>...>;
 		using ComponentsTypeTuple = type_tuple<ComponentTypes...>;
 
 		struct QueueRemoval;
 		struct SwapBuffers;
 		struct AddPendingComponents;
 		struct RequestAuthority;
+		struct ComponentMaskBuilder;
+		struct ResetComponentVersions;
 
 		friend QueueRemoval;
 		friend AddPendingComponents;
 		friend RequestAuthority;
 
-		// Index pool
-		static size_t GetNextGuid()
-		{
-			static size_t guid = kInvalidEntityGuid + 1;
-			return guid++;
-		}
+		// Structural changes requested by a single process, or by a dispatcher thread outside of processes. Each
+		// records into its own buffer so no locking is required, the buffers are merged in schedule order at the
+		// start of the next Process() (see ExecuteQueuedEntityActions).
+		struct alignas(64) CommandBuffer {
+			Vector<EntityType> EntityAdditions;
+			Vector<EntityType> EntityRemovals;
+			ComponentActionQueues ComponentActions;
+		};
+
+		// A slice of the per tick housekeeping (a single component type or a range of entities). Slices don't
+		// touch each other's data so they're scheduled on the dispatcher and spread over its threads.
+		class HousekeepingJob : public IProcess {
+		public:
+			using Callback = void(*)(BasicWorld*, size_t);
+		private:
+			BasicWorld* mOwner = nullptr;
+			Callback mCallback = nullptr;
+			size_t mSlice = 0;
+		public:
+			inline void Set(BasicWorld* owner, Callback callback, size_t slice)
+			{
+				mOwner = owner;
+				mCallback = callback;
+				mSlice = slice;
+			}
+
+			void Execute(double) override
+			{
+				mCallback(mOwner, mSlice);
+			}
+
+			inline double TimeTaken() const override
+			{
+				return 0.0;
+			}
 
-		std::vector<EntityType> AvailableEntities;
-		std::vector<EntityType> mEntities;
-		std::vector<EntityType> mPendingEntityAdditions;
-		std::vector<EntityType> mPendingEntityRemovals;
-		mutable std::vector<EntityType> mEntitySearchList;
-		mutable bool mEntitySearchListValid = false;
+			inline size_t GetProcessTypeId() const override
+			{
+				return 0;
+			}
+
+			inline size_t GetProcessGroupId() const override
+			{
+				return 0;
+			}
+		};
+
+		// Entities per housekeeping job, copying their component counts is too cheap to split any further
+		static const size_t kEntitiesPerHousekeepingJob = 4096;
+
+		using ComponentMask = std::bitset<sizeof...(ComponentTypes)>;
+		static const size_t kComponentBitWords = component_bit_words<sizeof...(ComponentTypes)>::value;
+
+		// Sorted indices of the live entities that have every component in Signature and none in Excluded. Queries
+		// are shared by all the iterators selecting the same components and only re-evaluate the entities touched
+		// by structural changes. Both masks are kept in the layout of EntityBase::ComponentBits as well.
+		struct EntityQuery {
+			ComponentMask Signature;
+			ComponentMask Excluded;
+			std::uint64_t RequiredBits[kComponentBitWords];
+			std::uint64_t ExcludedBits[kComponentBitWords];
+			Vector<size_t> Matches;
+			// Chunks of the matching archetypes, in row order. Only meaningful while mArchetypesClustered is set.
+			Vector<size_t> Chunks;
+		};
+
+		// Rows of entities sharing their component counts, clustered by ClusterArchetypes (ArchetypeStorage only).
+		// Each row owns Counts[n] components of type n, which follow each other in n's present buffer from Offsets[n] on.
+		struct Archetype {
+			size_t FirstRow;
+			size_t RowCount;
+			size_t FirstChunk;
+			size_t ChunkCount;
+			unsigned char Counts[sizeof...(ComponentTypes)];
+			size_t Offsets[sizeof...(ComponentTypes)];
+			std::uint64_t ComponentBits[kComponentBitWords];
+		};
+
+		// Up to StoragePolicy::chunk_entities rows of an archetype
+		struct ArchetypeChunk {
+			size_t Archetype;
+			size_t FirstRow;
+			size_t RowCount;
+		};
+
+		static const size_t kInvalidArchetype = ~size_t(0);
+
+		// Entity slots, indexed by the slot encoded in entity guids (see GetEntityGuidIndex)
+		std::vector<EntitySlot> mEntitySlots;
+		std::vector<size_t> mFreeEntityIndices;
+		Vector<EntityType> mEntities;
+		size_t mEntityCount = 0;
+
+		// Archetypes and chunks in row order along with the archetype of every row (kInvalidArchetype for free
+		// rows), which describe the buffers' layout while mArchetypesClustered is set. Rows freed since the last
+		// clustering are kept until the next one since the present buffers may still hold their components.
+		std::vector<Archetype> mArchetypes;
+		std::vector<ArchetypeChunk> mArchetypeChunks;
+		std::unordered_multimap<size_t, size_t> mArchetypeLookup;
+		Vector<size_t> mEntityArchetypes;
+		Vector<size_t> mFreedEntityRows;
+		Vector<size_t> mClusteredRows;
+		Vector<EntityType> mEntityScratch;
+		bool mArchetypesClustered = false;
 
 		ComponentStorage mComponents;
-		std::vector<ComponentAction> mPendingComponentActions;
-		int mComponentCountDelta[sizeof...(ComponentTypes)];
+		// One buffer per dispatcher thread followed by one per process in schedule order. Each thread's entry in
+		// mActiveCommandBuffers is the buffer it currently records into.
+		std::vector<CommandBuffer, detail::OverAlignedAllocator<CommandBuffer>> mCommandBuffers;
+		std::vector<size_t> mActiveCommandBuffers;
+		// Pending guid -> final guid of the entities added by the last ExecuteQueuedEntityActions, sorted. Kept until
+		// the next one so pending references can be resolved (see FindEntityPtr).
+		std::vector<std::pair<size_t, size_t>> mPendingEntityGuids;
+		ComponentActionQueues mPendingComponentActions;
+		ComponentActionQueues mComponentActionScratch;
+		HousekeepingJob mComponentJobs[sizeof...(ComponentTypes)];
+		std::vector<std::unique_ptr<HousekeepingJob>> mEntityJobs;
+		bool mComponentTypeRestructured[sizeof...(ComponentTypes)];
+
+		// Entities whose liveness or component presence may have changed since the end of the last tick, recorded
+		// per component type by the housekeeping jobs and in mTouchedEntities by everything else.
+		Vector<size_t> mTouchedEntities;
+		Vector<size_t> mTouchedEntitiesByType[sizeof...(ComponentTypes)];
+		std::vector<std::unique_ptr<EntityQuery>> mQueries;
+		Vector<size_t> mQueryScratch;
+		Vector<size_t> mQueryMergeScratch;
+		std::mutex mQueryMutex;
+		bool mQueriesOutdated = false;
 
 		std::vector<std::vector<ProcessData>> mProcessGroups;
 		std::vector<size_t> mDisabledProcessGroups;
 
+		// Processes of every group layered in batches that run one after another, rebuilt whenever processes are
+		// added or removed (see BuildProcessWaves)
+		std::vector<std::vector<ProcessData*>> mProcessWaves;
+		std::vector<ProcessJob*> mWaveScratch;
+		bool mProcessWavesOutdated = true;
+
 		AuthorityData mAuthorityExists[sizeof...(ComponentTypes)];
 		bool mProcessing = false;
 		DispatcherType mDispatcher;
 
+		// Version stamped by writes made during the current tick (or the next one, between ticks). Readers look for
+		// the previous version, which covers everything that changed in the buffers they read from since the last
+		// tick. Starts at 2 so writes made before the first tick aren't confused with the 0 versions of new entities.
+		unsigned mTickVersion = 2;
+
 		MetricsType mMetrics;
 		void* mUserPtr = nullptr;
 	public:
-		World()
+		BasicWorld()
 		{
-			memset(mComponentCountDelta, 0, sizeof(mComponentCountDelta));
-			memset(mAuthorityExists, 0, sizeof(mAuthorityExists));
+			Initialize();
+		}
+
+		/// Constructs the dispatcher from options, for dispatchers that take any (DispatcherOptions for a
+		/// ThreadPoolDispatcher for example).
+		template<typename DispatcherOptionsType, typename = typename std::enable_if<std::is_constructible<DispatcherType, const DispatcherOptionsType&>::value>::type>
+		explicit BasicWorld(const DispatcherOptionsType& dispatcherOptions) : mDispatcher(dispatcherOptions)
+		{
+			Initialize();
 		}
 
-		~World()
+		~BasicWorld()
 		{
 			tuple_for_each(mComponents, DestroyComponents());
 
@@ -188,9 +704,9 @@ namespace au {
 		}
 
 		// Make worlds noncopyable
-		World(World const&) = delete;
-		World(World&&) = delete;
-		World& operator=(World const&) = delete;
+		BasicWorld(BasicWorld const&) = delete;
+		BasicWorld(BasicWorld&&) = delete;
+		BasicWorld& operator=(BasicWorld const&) = delete;
 
 		inline MetricsType GetMetrics() const
 		{
@@ -198,108 +714,90 @@ namespace au {
 		}
 
 		EntityRef AddEntity() override
+		{
+			return AddEntity(0);
+		}
+
+		EntityRef AddEntity(int userValue) override
 		{
 			if (mProcessing)
 			{
-				return QueueAddEntity();
+				return QueueAddEntity(userValue);
 			}
 			else
 			{
-				EntityType ent;
-
-				if (!AvailableEntities.empty())
-				{
-					ent = AvailableEntities.back();
-					AvailableEntities.pop_back();
-					mEntities[ent.Index] = ent;
-					mEntitySearchListValid = false;
-				}
-				else
-				{
-					ent.Guid = GetNextGuid();
-					ent.Index = mEntities.size();
-					memset(ent.ComponentCount, 0, sizeof(ent.ComponentCount));
-					memset(ent.InternalComponentCount, 0, sizeof(ent.InternalComponentCount));
-					mEntities.push_back(ent);
-					mEntitySearchList.push_back(ent);
-				}
-
-				return{ ent.Guid, ent.Index, this, 0 };
+				EntityType& ent = PlaceEntity(MakeEntity(AllocateEntityGuid(), userValue));
+				return{ ent.Guid, ent.Index, this, ent.UserValue };
 			}
 		}
 
-		EntityRef AddEntity(int userValue)
+		// Queues an entity to be added at the start of the next world tick. While processing, slots are only
+		// assigned then (in schedule order, so guids don't depend on thread timing) and the returned reference
+		// holds a pending guid. Components can be queued for it right away, and once the entity is added FindEntity
+		// and EntityRef::Acquire resolve it to the final guid until the following tick starts. References that need
+		// to outlive that should be acquired in the meantime.
+		// Otherwise the slot is reserved immediately and the reference already holds the final guid and index.
+		EntityRef QueueAddEntity(int userValue = 0)
 		{
 			if (mProcessing)
 			{
-				return QueueAddEntity();
+				size_t buffer = GetCommandBufferIndex();
+				auto& additions = mCommandBuffers[buffer].EntityAdditions;
+				EntityType ent = MakeEntity(MakePendingEntityGuid(mTickVersion, buffer, additions.size()), userValue);
+				ent.Index = kInvalidEntityIndex;
+				additions.push_back(ent);
+				return{ ent.Guid, ent.Index, this, ent.UserValue };
 			}
 			else
 			{
-				EntityType ent;
-				ent.UserValue = userValue;
-
-				if (!AvailableEntities.empty())
-				{
-					ent = AvailableEntities.back();
-					AvailableEntities.pop_back();
-					mEntities[ent.Index] = ent;
-					mEntitySearchListValid = false;
-				}
-				else
-				{
-					ent.Guid = GetNextGuid();
-					ent.Index = mEntities.size();
-					memset(ent.ComponentCount, 0, sizeof(ent.ComponentCount));
-					memset(ent.InternalComponentCount, 0, sizeof(ent.InternalComponentCount));
-					mEntities.push_back(ent);
-					mEntitySearchList.push_back(ent);
-				}
-
-				return{ ent.Guid, ent.Index, this, userValue };
+				EntityType ent = MakeEntity(AllocateEntityGuid(), userValue);
+				GetCommandBuffer().EntityAdditions.push_back(ent);
+				return{ ent.Guid, ent.Index, this, ent.UserValue };
 			}
 		}
 
-		EntityRef QueueAddEntity()
+		// Adds count entities at once, reserving the entities vector a single time.
+		// While processing the entities are queued instead, just like AddEntity.
+		std::vector<EntityRef> AddEntities(size_t count, int userValue = 0)
 		{
-			EntityType ent;
-			if (!AvailableEntities.empty())
+			std::vector<EntityRef> added;
+			added.reserve(count);
+
+			if (mProcessing)
 			{
-				ent = AvailableEntities.back();
-				AvailableEntities.pop_back();
+				for (size_t n = 0; n < count; n++)
+					added.push_back(QueueAddEntity(userValue));
 			}
 			else
 			{
-				ent.Guid = GetNextGuid();
-				ent.Index = kInvalidEntityIndex;
-				memset(ent.ComponentCount, 0, sizeof(ent.ComponentCount));
-				memset(ent.InternalComponentCount, 0, sizeof(ent.InternalComponentCount));
+				ReserveEntities(count);
+
+				for (size_t n = 0; n < count; n++)
+				{
+					EntityType& ent = PlaceEntity(MakeEntity(AllocateEntityGuid(), userValue));
+					added.push_back({ ent.Guid, ent.Index, this, ent.UserValue });
+				}
 			}
 
-			mPendingEntityAdditions.push_back(ent);
-			return{ ent.Guid, ent.Index, this, 0 };
+			return added;
 		}
 
+		// Queues an entity to be removed at the start of the next world tick. Removing the same entity
+		// more than once (even from different threads) is harmless.
 		bool RemoveEntity(EntityRef ent) override
 		{
 			const EntityType* fent = FindEntityPtr(ent.Guid);
 
 			if (fent != nullptr)
 			{
-				for (auto& entToRemove : mPendingEntityRemovals)
-				{
-					if ((entToRemove.Guid == fent->Guid) && (entToRemove.Index == fent->Index))
-						return true;
-				}
-
-				mPendingEntityRemovals.push_back(*fent);
+				GetCommandBuffer().EntityRemovals.push_back(*fent);
 				return true;
 			}
 			else
 				return false;
 		}
 
-		EntityRef Migrate(World<ComponentTypes...>* destination, EntityRef migrated_entity)
+		EntityRef Migrate(BasicWorld* destination, EntityRef migrated_entity)
 		{
 			std::vector<EntityRef> performed_migrations;
 			std::vector<EntityRef> inherited_migrations;
@@ -356,21 +854,30 @@ namespace au {
 
 		inline void ReserveEntities(size_t count) final
 		{
-			if (AvailableEntities.size() < count)
+			// Clustered archetypes give every new entity a new row
+			if (StoragePolicy::clusters_archetypes)
+				mEntities.reserve(mEntities.size() + count);
+
+			if (mFreeEntityIndices.size() < count)
 			{
-				mEntities.reserve(mEntities.size() + (count - AvailableEntities.size()));
-				mEntitySearchList.reserve(mEntities.capacity());
+				mEntities.reserve(mEntities.size() + (count - mFreeEntityIndices.size()));
+				mEntitySlots.reserve(mEntities.capacity());
 			}
 		}
 
 		inline size_t CountEntities() const final
 		{
-			return mEntities.size() - AvailableEntities.size();
+			return mEntityCount;
 		}
 
 		inline size_t CountPendingEntities() const
 		{
-			return mPendingEntityAdditions.size() - mPendingEntityRemovals.size();
+			size_t count = 0;
+
+			for (auto& buffer : mCommandBuffers)
+				count += buffer.EntityAdditions.size() - buffer.EntityRemovals.size();
+
+			return count;
 		}
 
 		inline EntityRef GetEntity(size_t idx) const final
@@ -424,84 +931,195 @@ namespace au {
 				if (!entp)
 					return QueueAddComponent(ent, data);
 
-				auto& container = std::get<typename ComponentContainer<T>>(mComponents).PresentBuffer;
-				auto it = FindLastComponentBelongingToEntity(container, *entp);
-				size_t dist = std::distance(container.begin(), it);
+				auto& container = std::get<Container<T>>(mComponents);
+				auto it = FindLastComponent(container, container.PresentBuffer, *entp);
+				size_t dist = std::distance(container.PresentBuffer.begin(), it);
 				data.OwnerIndex = entp->Index;
-				container.insert(it, data);
+				container.PresentBuffer.insert(it, data);
+
+				// Every following slot moved, the lookup is rebuilt along with the future buffer
+				container.PresentLookup.clear();
+				container.AllBlocksDirty = true;
 				entp->ComponentCount[index_of<T, ComponentTypes...>::value]++;
 				entp->InternalComponentCount[index_of<T, ComponentTypes...>::value]++;
+				SetComponentBit(*entp, index_of<T, ComponentTypes...>::value, true);
+				container.AddedVersions.Mark(entp->Index, GetWriteVersion());
+				container.ChangedVersions.Mark(entp->Index, GetWriteVersion());
+				TouchEntity(entp->Index);
 
 				AddComponentImpl(entp->Guid, entp->Index, entp->UserValue, dist, data);
 				return true;
 			}
 		}
 
+		/// Adds components[n] to entities[n] for every n < count. Instead of inserting each component separately the
+		/// new components are sorted by owner and merged into the present buffer in a single pass, after which
+		/// pending actions are fixed up in a single pass as well, so this takes linear time in the buffer size.
+		/// Returns the number of components that were either added or queued.
 		template<typename T>
-		bool QueueAddComponent(EntityRef ent, T data)
+		size_t AddComponents(const EntityRef* entities, const T* components, size_t count)
 		{
-			auto* entp = FindEntityPtrExt(ent.Guid);
-			if (!entp)
-				return false;
+			size_t added = 0;
 
-			auto& container = std::get<typename ComponentContainer<T>>(mComponents);
-			auto& buffer = mProcessing ? container.FutureBuffer : container.PresentBuffer;
-			auto it = FindLastComponentBelongingToEntity(buffer, *entp);
-			data.OwnerIndex = entp->Index;
-
-			ComponentAction action = {
-				(size_t) std::distance(buffer.begin(), it),
-				0,
-				*entp,
-				data,
-				false,
-			};
-
-			mComponentCountDelta[ComponentsTypeTuple::index_of<T>::value]++;
-			mPendingComponentActions.push_back(action);
+			if (mProcessing)
+			{
+				for (size_t n = 0; n < count; n++)
+					added += QueueAddComponent(entities[n], components[n]) ? 1 : 0;
 
-			return true;
-		}
+				return added;
+			}
 
-		template<typename T>
-		bool QueueRemoveComponent(EntityRef ent, size_t idx = 0)
-		{
-			auto* entp = FindEntityPtr(ent.Guid);
-			if (!entp)
-				return false;
+			auto& container = std::get<Container<T>>(mComponents);
+			std::vector<T> sorted;
+			sorted.reserve(count);
 
-			if (idx >= entp->ComponentCount[ComponentsTypeTuple::index_of<T>::value])
-			{
-				return false;
-			}
-			else
+			for (size_t n = 0; n < count; n++)
 			{
-				auto& container = std::get<typename ComponentContainer<T>>(mComponents);
-				auto& buffer = mProcessing ? container.FutureBuffer : container.PresentBuffer;
-				auto it = FindFirstComponentBelongingToEntity(buffer, *entp);
+				auto* entp = FindEntityPtr(entities[n].Guid);
 
-				if (it != buffer.end())
+				if (!entp)
 				{
-					it += idx;
+					added += QueueAddComponent(entities[n], components[n]) ? 1 : 0;
+				}
+				else
+				{
+					sorted.push_back(components[n]);
+					sorted.back().OwnerIndex = entp->Index;
+					entp->ComponentCount[ComponentsTypeTuple::index_of<T>::value]++;
+					entp->InternalComponentCount[ComponentsTypeTuple::index_of<T>::value]++;
+					SetComponentBit(*entp, ComponentsTypeTuple::index_of<T>::value, true);
+					container.AddedVersions.Mark(entp->Index, GetWriteVersion());
+					container.ChangedVersions.Mark(entp->Index, GetWriteVersion());
+					TouchEntity(entp->Index);
+				}
+			}
 
-					ComponentAction removalAction = {
-						std::distance(buffer.begin(), it),
-						1,
-						*entp,
-						detail::RemovalAction{ T::Id() },
-						true,
-					};
+			if (sorted.empty())
+				return added;
 
-					for (ComponentAction& action : mPendingComponentActions)
-					{
-						if (action.destructive && (action.index == removalAction.index) &&
-							(action.removeLength == removalAction.removeLength) &&
-							(action.owner.Guid == removalAction.owner.Guid))
-							return true;
-					}
+			auto owner_sorter = [](const T& lhs, const T& rhs)
+			{
+				return lhs.OwnerIndex < rhs.OwnerIndex;
+			};
+
+			if (!std::is_sorted(sorted.begin(), sorted.end(), owner_sorter))
+				std::stable_sort(sorted.begin(), sorted.end(), owner_sorter);
+
+			// Merge from the back so the buffer only has to grow once. New components are placed after the
+			// components their owner already has, and the position each one was inserted at (relative to the
+			// original buffer) is recorded so pending actions can be offset afterwards.
+			auto& buffer = container.PresentBuffer;
+			std::vector<size_t> positions(sorted.size());
+			size_t src = buffer.size();
+			size_t pending = sorted.size();
+			size_t dst = buffer.size() + sorted.size();
+
+			buffer.resize(dst);
+
+			while (pending > 0)
+			{
+				if ((src > 0) && (buffer[src - 1].OwnerIndex > sorted[pending - 1].OwnerIndex))
+				{
+					CopyComponentRange(buffer, --dst, buffer, --src, 1);
+				}
+				else
+				{
+					positions[--pending] = src;
+					StoreComponentAt(buffer, --dst, sorted[pending]);
+				}
+			}
+
+			if (component_traits<T>::sparse_set)
+				RebuildComponentLookup(buffer, container.PresentLookup);
+
+			container.AllBlocksDirty = true;
+			OffsetPendingComponentActions(std::get<ComponentActionQueue<T>>(mPendingComponentActions), positions);
+
+			for (auto& cmdbuffer : mCommandBuffers)
+				OffsetPendingComponentActions(std::get<ComponentActionQueue<T>>(cmdbuffer.ComponentActions), positions);
+
+			return added + sorted.size();
+		}
+
+		template<typename T>
+		inline size_t AddComponents(const std::vector<EntityRef>& entities, const std::vector<T>& components)
+		{
+			assert(entities.size() == components.size());
+			return AddComponents(entities.data(), components.data(), std::min(entities.size(), components.size()));
+		}
+
+		/// Queues a component to be added at the start of the next world tick. The entity may still be pending,
+		/// components queued for entities that don't exist by then are discarded.
+		template<typename T>
+		bool QueueAddComponent(EntityRef ent, T data)
+		{
+			if (!ent.IsValid() || (ent.Owner != this))
+				return false;
+
+			// Entities queued during the current tick don't have a slot yet, their components are positioned once they
+			// do (see ResolvePendingOwners). Other queued entities' guids already identify their slot.
+			if (IsUnresolvedEntityGuid(ent.Guid))
+			{
+				data.OwnerIndex = kInvalidEntityIndex;
+				std::get<ComponentActionQueue<T>>(GetCommandBuffer().ComponentActions).Additions.push_back({ 0, ent.Guid, kInvalidEntityIndex, data });
+				return true;
+			}
+
+			const EntityType* entp = FindEntityPtr(ent.Guid);
+
+			// Pending guids that no longer resolve belong to entities that are gone or were never added
+			if (!entp && IsPendingEntityGuid(ent.Guid))
+				return false;
+
+			EntityType owner = entp ? *entp : MakeEntity(ent.Guid, ent.UserValue);
+
+			auto& container = std::get<Container<T>>(mComponents);
+			auto& buffer = mProcessing ? container.GetFutureBuffer() : container.PresentBuffer;
+			auto it = FindLastComponent(container, buffer, owner);
+			data.OwnerIndex = owner.Index;
+
+			std::get<ComponentActionQueue<T>>(GetCommandBuffer().ComponentActions).Additions.push_back({
+				(size_t) std::distance(buffer.begin(), it),
+				owner.Guid,
+				owner.Index,
+				data,
+			});
+
+			return true;
+		}
+
+		template<typename T>
+		bool QueueRemoveComponent(EntityRef ent, size_t idx = 0)
+		{
+			auto* entp = FindEntityPtr(ent.Guid);
+			if (!entp)
+				return false;
+
+			// The removal index refers to the future buffer while processing, so its count must be used as well
+			auto count = mProcessing ? entp->InternalComponentCount : entp->ComponentCount;
+
+			if (idx >= count[ComponentsTypeTuple::index_of<T>::value])
+			{
+				return false;
+			}
+			else
+			{
+				auto& container = std::get<Container<T>>(mComponents);
+				auto& buffer = mProcessing ? container.GetFutureBuffer() : container.PresentBuffer;
+				auto it = FindFirstComponent(container, buffer, *entp);
+
+				if (it != buffer.end())
+				{
+					it += idx;
 
-					mComponentCountDelta[ComponentsTypeTuple::index_of<T>::value]--;
-					mPendingComponentActions.push_back(removalAction);
+					// Duplicate removals are discarded when the command buffers are merged
+					std::get<ComponentActionQueue<T>>(GetCommandBuffer().ComponentActions).Removals.push_back({
+						(size_t) std::distance(buffer.begin(), it),
+						1,
+						entp->Guid,
+						entp->Index,
+						true,
+					});
 
 					return true;
 				}
@@ -537,7 +1155,16 @@ namespace au {
 		template<typename T>
 		inline T* GetComponent(EntityRef ent, unsigned char idx = 0)
 		{
-			return GetComponentInContainer<T>(ent, std::get<typename ComponentContainer<T>>(mComponents).PresentBuffer, idx);
+			static_assert(!component_traits<T>::soa, "Components with SoA fields aren't stored as a whole, use LoadComponent or ForEachChunk.");
+
+			auto& container = std::get<Container<T>>(mComponents);
+			T* component = GetComponentInContainer<T>(ent, container, container.PresentBuffer, idx);
+
+			// Outside of world ticks the present buffer may be written to through the returned pointer
+			if (component && !mProcessing && !container.AllBlocksDirty)
+				container.MarkFutureDirty(component - container.PresentBuffer.data());
+
+			return component;
 		}
 
 		/// Attempts to return a pointer to the specified component contained within a future buffer
@@ -546,7 +1173,78 @@ namespace au {
 		template<typename T>
 		inline T* GetFutureComponent(EntityRef ent, unsigned char idx = 0)
 		{
-			return GetComponentInContainer<T>(ent, std::get<typename ComponentContainer<T>>(mComponents).FutureBuffer, idx);
+			static_assert(!component_traits<T>::soa, "Components with SoA fields aren't stored as a whole, use StoreComponent or ForEachChunk.");
+
+			auto& container = std::get<Container<T>>(mComponents);
+
+			if (mProcessing)
+				container.SyncFutureBuffer();
+
+			T* component = GetComponentInContainer<T>(ent, container, container.GetFutureBuffer(), idx);
+
+			if (component)
+			{
+				if (!container.AllBlocksDirty)
+					container.MarkFutureDirty(component - container.GetFutureBuffer().data());
+
+				container.ChangedVersions.Mark(component->OwnerIndex, GetWriteVersion());
+			}
+
+			return component;
+		}
+
+		/// Copies the specified component of the present buffer into component, works for any type but is the only way
+		/// to read whole components listing SoA fields.
+		/// Returns false if the entity's invalid or does not possess this component
+		/// NOTE: This function is unsafe and does not verify if there's already an authority request for this component type.
+		template<typename T>
+		inline bool LoadComponent(EntityRef ent, T& component, unsigned char idx = 0)
+		{
+			auto& container = std::get<Container<T>>(mComponents);
+			auto* entp = FindEntityPtr(ent.Guid);
+			if (!entp || idx >= entp->ComponentCount[ComponentsTypeTuple::index_of<T>::value])
+				return false;
+
+			auto it = FindFirstComponent(container, container.PresentBuffer, *entp);
+			if (it == container.PresentBuffer.end())
+				return false;
+
+			component = LoadComponentAt(container.PresentBuffer, std::distance(container.PresentBuffer.begin(), it) + idx);
+			return true;
+		}
+
+		/// Overwrites the specified component of the future buffer with component, keeping its owner, works for any type but
+		/// is the only way to write whole components listing SoA fields.
+		/// Returns false if the entity's invalid or does not possess this component
+		/// NOTE: This function is unsafe and does not verify if there's already an authority request for this component type.
+		template<typename T>
+		inline bool StoreComponent(EntityRef ent, const T& component, unsigned char idx = 0)
+		{
+			auto& container = std::get<Container<T>>(mComponents);
+
+			if (mProcessing)
+				container.SyncFutureBuffer();
+
+			auto& buffer = container.GetFutureBuffer();
+			auto* entp = FindEntityPtr(ent.Guid);
+			if (!entp || idx >= entp->ComponentCount[ComponentsTypeTuple::index_of<T>::value])
+				return false;
+
+			auto it = FindFirstComponent(container, buffer, *entp);
+			if (it == buffer.end())
+				return false;
+
+			size_t index = std::distance(buffer.begin(), it) + idx;
+			auto owner = buffer[index].OwnerIndex;
+
+			StoreComponentAt(buffer, index, component);
+			buffer[index].OwnerIndex = owner;
+
+			if (!container.AllBlocksDirty)
+				container.MarkFutureDirty(index);
+
+			container.ChangedVersions.Mark(owner, GetWriteVersion());
+			return true;
 		}
 
 		template<typename T>
@@ -573,12 +1271,28 @@ namespace au {
 
 		void AddProcess(IProcess* proc, size_t procGroup) override
 		{
-			while (mProcessGroups.size() <= procGroup)
-			{
-				mProcessGroups.emplace_back();
-			}
+			AddProcessData({ proc, true, false, ComponentMask(), ComponentMask(), nullptr }, procGroup);
+		}
+
+		/// Adds a process to procGroup. Groups run one after another, except for processes declaring their component
+		/// access (see process_traits) which only wait for the processes of earlier groups they conflict with:
+		/// both may write to a component (through authority or EditOptional), or one reads a single buffered
+		/// component the other writes to.
+		/// Processes that don't declare their access conflict with every process outside their group.
+		template<typename ProcessType>
+		void AddProcess(ProcessType* proc, size_t procGroup)
+		{
+			static_assert(std::is_base_of<IProcess, ProcessType>::value, "Processes must derive from IProcess");
+
+			using traits = process_traits<ProcessType>;
+			ComponentMaskBuilder writes;
+			ComponentMaskBuilder reads;
 
-			mProcessGroups[procGroup].push_back({ proc, true });
+			// EditOptional writes to optional components without authority, so they count as writes
+			traits::authority::for_each(writes);
+			traits::optionals::for_each(writes);
+			traits::reads::for_each(reads);
+			AddProcessData({ proc, true, traits::declares_access, writes.Mask, reads.Mask | writes.Mask, nullptr }, procGroup);
 		}
 
 		void RemoveProcess(IProcess* proc) override
@@ -590,6 +1304,7 @@ namespace au {
 					if (it->Process == proc)
 					{
 						procgroup.erase(it);
+						mProcessWavesOutdated = true;
 						return;
 					}
 				}
@@ -649,6 +1364,23 @@ namespace au {
 			return false;
 		}
 
+		/// Returns the moving average of a process' execution time in seconds, measured by the world every tick
+		double GetProcessTime(size_t processTypeId) const
+		{
+			for (auto& procgroup : mProcessGroups)
+			{
+				for (auto& procdata : procgroup)
+				{
+					if (procdata.Process->GetProcessTypeId() == processTypeId)
+					{
+						return procdata.Job->TimeTaken();
+					}
+				}
+			}
+
+			return 0.0;
+		}
+
 		void SetProcessGroupEnabled(size_t group_id, bool enabled)
 		{
 			auto it = std::find(mDisabledProcessGroups.begin(), mDisabledProcessGroups.end(), group_id);
@@ -668,12 +1400,21 @@ namespace au {
 			return std::find(mDisabledProcessGroups.begin(), mDisabledProcessGroups.end(), group_id) == mDisabledProcessGroups.end();
 		}
 
+		/// Returns the number of dispatcher batches the process groups get merged into every tick
+		size_t CountProcessBatches()
+		{
+			if (mProcessWavesOutdated)
+				BuildProcessWaves();
+
+			return mProcessWaves.size();
+		}
+
 		void Process(double timeSec) override
 		{
 			auto start_time = std::chrono::high_resolution_clock::now();
 
 			mProcessing = true;
-			memset(&mMetrics, 0, sizeof(MetricsType));
+			mMetrics = MetricsType();
 
 			// Update Entities
 			ExecuteQueuedEntityActions();
@@ -682,21 +1423,40 @@ namespace au {
 
 			// Update components
 			start_time = std::chrono::high_resolution_clock::now();
-			ExecutePendingUpdates();
+			DispatchPendingUpdates();
+
+			if (StoragePolicy::clusters_archetypes && ArchetypesOutdated())
+				ClusterArchetypes();
+
+			RefreshQueries(false);
 			delta_time = std::chrono::high_resolution_clock::now() - start_time;
 			mMetrics.ComponentUpdateTime = delta_time.count();
 
 			// Execute processes
 			start_time = std::chrono::high_resolution_clock::now();
 			mDispatcher.SetTime(timeSec);
-			for (auto& procgroup : mProcessGroups)
+
+			if (mProcessWavesOutdated)
+				BuildProcessWaves();
+
+			for (auto& wave : mProcessWaves)
 			{
-				for (auto& procdata : procgroup)
+				mWaveScratch.clear();
+
+				for (ProcessData* procdata : wave)
 				{
-					if (procdata.Enabled && GetProcessGroupEnabled(procdata.Process->GetProcessGroupId()))
-						mDispatcher.Schedule(procdata.Process);
+					if (procdata->Enabled && GetProcessGroupEnabled(procdata->Process->GetProcessGroupId()))
+						mWaveScratch.push_back(procdata->Job.get());
 				}
 
+				// Longest first, so a long process doesn't get picked up last and stretch the tick
+				std::stable_sort(mWaveScratch.begin(), mWaveScratch.end(), [](const ProcessJob* lhs, const ProcessJob* rhs) {
+					return lhs->TimeTaken() > rhs->TimeTaken();
+				});
+
+				for (ProcessJob* job : mWaveScratch)
+					mDispatcher.Schedule(job);
+
 				mDispatcher.Execute();
 				memset(mAuthorityExists, 0, sizeof(mAuthorityExists));
 			}
@@ -712,11 +1472,15 @@ namespace au {
 
 			// Housekeeping
 			start_time = std::chrono::high_resolution_clock::now();
-			tuple_for_each(mComponents, SwapBuffers());
 
-			for (auto& entity : mEntities)
-				memcpy(entity.ComponentCount, entity.InternalComponentCount, sizeof(entity.InternalComponentCount));
+			// Restructured buffers and the counts published along with them no longer match the archetypes
+			if (AnyDoubleBufferedTypeRestructured())
+				mArchetypesClustered = false;
 
+			DispatchBufferSwap();
+			mQueriesOutdated = true;
+			RefreshQueries(true);
+			mTickVersion++;
 			mProcessing = false;
 			delta_time = std::chrono::high_resolution_clock::now() - start_time;
 			mMetrics.TotalProcessTime = delta_time.count();
@@ -731,49 +1495,62 @@ namespace au {
 				mMetrics.ProcessExecutionTime + mMetrics.EventHandlingTime;
 		}
 
-		template <typename AuthSet, typename OptionSet, typename RequiredSet>
+		/// Iterates over the entities having every component of RequiredSet. FilterSet is RequiredSet as selected by
+		/// the caller, whose Changed<T>, Added<T> and Without<T...> entries restrict the visited entities further.
+		template <typename AuthSet, typename OptionSet, typename RequiredSet, typename FilterSet = RequiredSet>
 		struct ComponentIterator {
 		private:
-			template<bool editable>
-			inline typename std::enable_if<editable, bool>::type GetNumComponents(const EntityType& ent, std::size_t component_index)
-			{
-				return ent.InternalComponentCount[component_index];
-			}
+			static const bool HasChangeFilters = detail::has_change_filters<FilterSet>::value;
+
+			// Checks an entity (or the block containing it) against the Changed<T> and Added<T> filters
+			struct ChangeFilter {
+				BasicWorld* Owner;
+				size_t EntityIndex;
+				unsigned Version;
+				bool Block;
+				bool Passed;
+
+				template<typename T>
+				inline void operator()(T*, std::size_t)
+				{
+				}
 
-			template<bool editable>
-			inline typename std::enable_if<!editable, bool>::type GetNumComponents(const EntityType& ent, std::size_t component_index)
-			{
-				return ent.ComponentCount[component_index];
-			}
+				template<typename T>
+				inline void operator()(Changed<T>*, std::size_t)
+				{
+					Check(std::get<Container<T>>(Owner->mComponents).ChangedVersions);
+				}
 
-			inline bool CheckComponentPresence(const EntityType& ent, std::size_t component_index)
-			{
-				return (ent.ComponentCount[component_index] > 0);
-			}
+				template<typename T>
+				inline void operator()(Added<T>*, std::size_t)
+				{
+					Check(std::get<Container<T>>(Owner->mComponents).AddedVersions);
+				}
 
-			template <typename TypeSeq>
-			inline typename std::enable_if<TypeSeq::is_last, bool>::type HasComponentsImpl(const EntityType& ent)
-			{
-				return CheckComponentPresence(ent, ComponentsTypeTuple::index_of<typename TypeSeq::head>::value);
-			}
+				inline void Check(const ComponentVersionTable& versions)
+				{
+					if (Passed)
+						Passed = Block ? versions.BlockWrittenAt(EntityIndex / ComponentVersionTable::kBlockSize, Version) : versions.WrittenAt(EntityIndex, Version);
+				}
+			};
 
-			template <typename TypeSeq>
-			inline typename std::enable_if<!TypeSeq::is_last, bool>::type HasComponentsImpl(const EntityType& ent)
+			inline bool PassesChangeFilters(size_t entity_index, bool block)
 			{
-				return CheckComponentPresence(ent, ComponentsTypeTuple::index_of<typename TypeSeq::head>::value) && 
-					HasComponentsImpl<TypeSeq::tail>(ent);
+				ChangeFilter filter{ mOwner, entity_index, mOwner->mTickVersion - 1, block, true };
+				FilterSet::for_each(filter);
+				return filter.Passed;
 			}
 
-			template <typename CompSet>
-			inline typename std::enable_if<CompSet::count != 0, bool>::type HasComponents(const EntityType& ent)
+			template<bool editable>
+			inline typename std::enable_if<editable, bool>::type GetNumComponents(const EntityType& ent, std::size_t component_index)
 			{
-				return HasComponentsImpl<CompSet::as_type_seq>(ent);
+				return ent.InternalComponentCount[component_index];
 			}
 
-			template <typename CompSet>
-			inline typename std::enable_if<CompSet::count == 0, bool> ::type HasComponents(const EntityType& ent)
+			template<bool editable>
+			inline typename std::enable_if<!editable, bool>::type GetNumComponents(const EntityType& ent, std::size_t component_index)
 			{
-				return true;
+				return ent.ComponentCount[component_index];
 			}
 
 			template <typename TypeSeq, bool editable>
@@ -796,23 +1573,38 @@ namespace au {
 			}
 
 			template <typename CompSet, bool editable>
-			inline typename std::enable_if<CompSet::count == 0, bool>::type HasAnyComponents(const EntityType& ent)
+			inline typename std::enable_if<CompSet::count == 0, bool>::type HasAnyComponents(const EntityType&)
 			{
 				return true;
 			}
 		protected:
 			static const std::size_t TotalComponentCount = AuthSet::count + RequiredSet::count + OptionSet::count * 2;
 
-			World* mOwner;
+			BasicWorld* mOwner;
+			const Vector<size_t>* mMatches;
+			size_t mNextMatch = 0;
 			size_t mCurEntityIndex = kInvalidEntityIndex;
-			size_t mEntitySkipCount = 0;
+			size_t mPassedBlock = kInvalidEntityIndex;
 			bool mOutdatedIndex = true;
-			bool mInitialState = true;
 			int mCurComponentIndices[TotalComponentCount]; // Contains, in order: Required, Auth, Optionals
+
+			static ComponentMaskBuilder MakeSignature()
+			{
+				ComponentMaskBuilder builder;
+				FilterSet::for_each(builder);
+				AuthSet::for_each(builder);
+				return builder;
+			}
 		public:
-			ComponentIterator(World* e) : mOwner(e)
+			ComponentIterator(BasicWorld* e) : mOwner(e)
 			{
+				static const ComponentMaskBuilder signature = MakeSignature();
+
 				memset(mCurComponentIndices, 0, sizeof(mCurComponentIndices));
+				mMatches = &e->AcquireQuery(signature.Mask, signature.Excluded).Matches;
+
+				// Optional components can be edited without authority
+				OptionSet::for_each(SyncFutureBuffers(e));
 			}
 
 			virtual ~ComponentIterator()
@@ -824,36 +1616,39 @@ namespace au {
 				mOwner->mEntities[entity.Index]
 			}
 
+			/// Moves to the next entity matching the iterator's query, only matching entities are visited.
 			bool Advance()
 			{
-				EntityType cent;
-
-				do
+				while (mNextMatch < mMatches->size())
 				{
-					if (mCurEntityIndex == kInvalidEntityIndex)
+					size_t next = (*mMatches)[mNextMatch];
+					size_t block = next / ComponentVersionTable::kBlockSize;
+
+					// Blocks of entities none of which passes the filters are skipped at once
+					if (HasChangeFilters && (block != mPassedBlock))
 					{
-						if (!mInitialState)
-						{
-							return false;
-						}
-						else
+						if (!PassesChangeFilters(next, true))
 						{
-							mCurEntityIndex = 0;
-							mInitialState = false;
+							mNextMatch = std::distance(mMatches->begin(),
+								std::lower_bound(mMatches->begin() + mNextMatch, mMatches->end(), (block + 1) * ComponentVersionTable::kBlockSize));
+							continue;
 						}
+
+						mPassedBlock = block;
 					}
-					else
-						mCurEntityIndex++;
 
-					if (mCurEntityIndex >= mOwner->mEntities.size())
-						break;
+					mNextMatch++;
 
-					mEntitySkipCount++;
-					cent = mOwner->mEntities[mCurEntityIndex];
-				} while ((cent.Guid == kInvalidEntityGuid) || !HasComponents<RequiredSet>(cent) || !HasComponents<AuthSet>(cent));
+					if (HasChangeFilters && !PassesChangeFilters(next, false))
+						continue;
 
-				mOutdatedIndex = true;
-				return mCurEntityIndex != mOwner->mEntities.size();
+					mCurEntityIndex = next;
+					mOutdatedIndex = true;
+					return true;
+				}
+
+				mCurEntityIndex = mOwner->mEntities.size();
+				return false;
 			}
 
 			bool Advance(size_t count)
@@ -897,6 +1692,7 @@ namespace au {
 			template<typename T>
 			const T& Get(size_t index = 0)
 			{
+				static_assert(!component_traits<T>::soa, "Components with SoA fields aren't stored as a whole, use ForEachChunk.");
 				static_assert(RequiredSet::contains<T>::value, "T must be one of the iterator's required components.");
 				int compIndex = RequiredSet::index_of<T>::value;
 
@@ -905,13 +1701,14 @@ namespace au {
 				if (mOutdatedIndex)
 					UpdateIndices();
 
-				const auto& container = std::get<ComponentContainer<T>>(mOwner->mComponents);
+				const auto& container = std::get<Container<T>>(mOwner->mComponents);
 				return container.PresentBuffer[mCurComponentIndices[compIndex] + index];
 			}
 
 			template<typename T>
 			T const* GetOptional(size_t index = 0)
 			{
+				static_assert(!component_traits<T>::soa, "Components with SoA fields aren't stored as a whole, use ForEachChunk.");
 				static_assert(OptionSet::contains<T>::value, "T must be one of the iterator's optional components.");
 				int compIndex = RequiredSet::count + AuthSet::count + OptionSet::index_of<T>::value;
 
@@ -920,7 +1717,7 @@ namespace au {
 				if (mOutdatedIndex)
 					UpdateIndices();
 
-				const auto& container = std::get<ComponentContainer<T>>(mOwner->mComponents);
+				const auto& container = std::get<Container<T>>(mOwner->mComponents);
 				if ((mCurComponentIndices[compIndex] + index) >= container.PresentBuffer.size())
 					return nullptr;
 				else
@@ -937,6 +1734,7 @@ namespace au {
 			template<typename T>
 			T* Edit(size_t index = 0)
 			{
+				static_assert(!component_traits<T>::soa, "Components with SoA fields aren't stored as a whole, use ForEachChunk.");
 				static_assert(AuthSet::contains<T>::value, "T must be one of the iterator's editable components.");
 				int compIndex = RequiredSet::count + AuthSet::index_of<T>::value;
 
@@ -945,13 +1743,16 @@ namespace au {
 				if (mOutdatedIndex)
 					UpdateIndices();
 
-				auto& container = std::get<ComponentContainer<T>>(mOwner->mComponents);
-				return &container.FutureBuffer[mCurComponentIndices[compIndex] + index];
+				auto& components = std::get<Container<T>>(mOwner->mComponents);
+				components.MarkFutureDirty(mCurComponentIndices[compIndex] + index);
+				components.ChangedVersions.Mark(mCurEntityIndex, mOwner->GetWriteVersion());
+				return &components.GetFutureBuffer()[mCurComponentIndices[compIndex] + index];
 			}
 
 			template<typename T>
 			T* EditOptional(size_t index = 0)
 			{
+				static_assert(!component_traits<T>::soa, "Components with SoA fields aren't stored as a whole, use ForEachChunk.");
 				static_assert(OptionSet::contains<T>::value, "T must be one of the iterator's optional components.");
 				int compIndex = RequiredSet::count + AuthSet::count + OptionSet::count + OptionSet::index_of<T>::value;
 
@@ -960,49 +1761,43 @@ namespace au {
 				if (mOutdatedIndex)
 					UpdateIndices();
 
-				auto& container = std::get<ComponentContainer<T>>(mOwner->mComponents);
-				if ((mCurComponentIndices[compIndex] + index) >= container.FutureBuffer.size())
+				auto& components = std::get<Container<T>>(mOwner->mComponents);
+				auto& container = components.GetFutureBuffer();
+				if ((mCurComponentIndices[compIndex] + index) >= container.size())
 					return nullptr;
 				else
 				{
-					auto* comp = &container.FutureBuffer[mCurComponentIndices[compIndex] + index];
+					auto* comp = &container[mCurComponentIndices[compIndex] + index];
 
 					if (comp->OwnerIndex != mCurEntityIndex)
 						return nullptr;
-					else
-						return comp;
+
+					components.MarkFutureDirty(mCurComponentIndices[compIndex] + index);
+					components.ChangedVersions.Mark(mCurEntityIndex, mOwner->GetWriteVersion());
+					return comp;
 				}
 			}
 		protected:
+			// Entities are visited in increasing order so every component index only moves forward, the buffers are
+			// merge joined with the query's matches. Sparse set lookups are constant time and used instead, as are the
+			// archetypes when they describe the buffer's layout.
 			template <typename TypeSeqContainer, typename ComponentType>
 			inline void UpdateIndicesImpl(std::size_t offset, bool is_edit)
 			{
 				int compIndex = offset + TypeSeqContainer::index_of<ComponentType>::value;
-				const auto& container = is_edit ? std::get<ComponentContainer<ComponentType>>(mOwner->mComponents).FutureBuffer :
-					std::get<ComponentContainer<ComponentType>>(mOwner->mComponents).PresentBuffer;
+				const auto& components = std::get<Container<ComponentType>>(mOwner->mComponents);
+				const auto& container = is_edit ? components.GetFutureBuffer() : components.PresentBuffer;
+				size_t position;
 
-				// Check if the next component's near the previous one
-				// This provides a speedup since we don't have to resort to binary search for small deltas
-				if (mEntitySkipCount < 5)
+				if (mOwner->FindArchetypeComponent<ComponentType>(mCurEntityIndex, is_edit, position))
+					mCurComponentIndices[compIndex] = position;
+				else if (component_traits<ComponentType>::sparse_set)
 				{
-					for (size_t n = 0; n <= mEntitySkipCount; n++)
-					{
-						size_t cidx = mCurComponentIndices[compIndex] + n;
-						if (container.size() <= cidx)
-							break;
-						else
-						{
-							if (container[cidx].OwnerIndex == mCurEntityIndex)
-							{
-								mCurComponentIndices[compIndex] = cidx;
-								return;
-							}
-						}
-					}
+					auto it = mOwner->FindFirstComponent(components, container, mOwner->mEntities[mCurEntityIndex]);
+					mCurComponentIndices[compIndex] = std::distance(container.begin(), it);
 				}
-
-				auto it = mOwner->FindFirstComponentBelongingToEntity(container, mOwner->mEntities[mCurEntityIndex]);
-				mCurComponentIndices[compIndex] = std::distance(container.begin(), it);
+				else
+					mCurComponentIndices[compIndex] = SeekComponentOwner(container.data(), container.size(), mCurComponentIndices[compIndex], mCurEntityIndex);
 			}
 
 			template <typename TypeSeqContainer, typename TypeSeq>
@@ -1025,7 +1820,7 @@ namespace au {
 			}
 
 			template <typename TypeSeqContainer>
-			inline typename std::enable_if<TypeSeqContainer::count == 0, void>::type DoIndicesUpdate(std::size_t offset, bool is_edit)
+			inline typename std::enable_if<TypeSeqContainer::count == 0, void>::type DoIndicesUpdate(std::size_t, bool)
 			{
 			}
 
@@ -1042,436 +1837,1886 @@ namespace au {
 					DoIndicesUpdate<OptionSet>(RequiredSet::count + AuthSet::count + OptionSet::count, true);
 
 				mOutdatedIndex = false;
-				mEntitySkipCount = 0;
 			}
 		};
 
-		EntityRef PerformMigration(World<ComponentTypes...>* destination, EntityRef migrated_entity, std::vector<EntityRef>* inherited_migrations)
+		/// Iterator over the entities having every selected component, T may contain Changed<>, Added<> and Without<> filters
+		template<typename AuthSet, typename OptionSet, typename... T>
+		using FilteredComponentIterator = ComponentIterator<AuthSet, OptionSet, typename detail::selected_components<T...>::type, ComponentSet<T...>>;
+
+		EntityRef PerformMigration(BasicWorld* destination, EntityRef migrated_entity, std::vector<EntityRef>* inherited_migrations)
 		{
 			enforceRet(migrated_entity.IsValid(), EntityRef::Invalid);
 			enforceRet(!mProcessing, EntityRef::Invalid);
 			enforceRet(!destination->mProcessing, EntityRef::Invalid);
 
-			// Migrate the entity
-			EntityType& source_entity = mEntities[migrated_entity.Index];
-			EntityType ent = source_entity;
+			// Migrate the entity, whose index may be outdated if archetypes are clustered
+			EntityType* source_entity_ptr = FindEntityPtr(migrated_entity.Guid);
 
-			enforceRet(source_entity.Guid != kInvalidEntityGuid, EntityRef::Invalid);
+			enforceRet(source_entity_ptr != nullptr, EntityRef::Invalid);
 
-			if (!destination->AvailableEntities.empty())
-			{
-				auto target_ent = destination->AvailableEntities.back();
-				destination->AvailableEntities.pop_back();
-				destination->mEntities[target_ent.Index] = ent;
-				destination->mEntitySearchListValid = false;
-			}
-			else
-			{
-				ent.Index = destination->mEntities.size();
-				memset(ent.ComponentCount, 0, sizeof(ent.ComponentCount));
-				memset(ent.InternalComponentCount, 0, sizeof(ent.InternalComponentCount));
-				destination->mEntities.push_back(ent);
-				destination->mEntitySearchListValid = false;
-			}
+			EntityType& source_entity = *source_entity_ptr;
 
-			source_entity.Guid = EntityRef::Invalid.Guid;
+			EntityType ent = destination->PlaceEntity(destination->MakeEntity(destination->AllocateEntityGuid(), source_entity.UserValue));
 
 			// Migrate the components
 			tuple_for_each(mComponents, QueueRemoval(this, source_entity, false));
 			tuple_for_each(mComponents, ComponentMigrator(this, destination, source_entity, ent, inherited_migrations));
 
-			// Queue the source entity removal
-			memset(source_entity.ComponentCount, 0, sizeof(source_entity.ComponentCount));
-			memset(source_entity.InternalComponentCount, 0, sizeof(source_entity.InternalComponentCount));
-
-			AvailableEntities.push_back(source_entity);
-			memset(&source_entity, 0, sizeof(EntityType));
-			source_entity.Guid = kInvalidEntityGuid;
-			source_entity.Index = kInvalidEntityIndex;
+			// Release the source entity's slot
+			FreeEntity(source_entity);
 
 			return{ ent.Guid, ent.Index, destination, ent.UserValue };
 		}
 
-		// Component iterators
+		// Component iterators. Selected components may be wrapped in Changed<> or Added<> to only visit the entities
+		// whose component changed or was added since the previous tick (see ComponentVersionTable), and Without<>
+		// entries exclude the entities having any of their components.
 		template<typename MaybeAuthority, typename MaybeOptional, typename... T>
 		typename std::enable_if<is_type_tuple<MaybeAuthority>::value && is_type_tuple<MaybeOptional>::value,
-			ComponentIterator<MaybeAuthority, MaybeOptional, ComponentSet<T...>>>::type GetComponentIterator(void* authority_source = nullptr)
+			FilteredComponentIterator<MaybeAuthority, MaybeOptional, T...>>::type GetComponentIterator(void* authority_source = nullptr)
 		{
 			if (!mProcessing)
 				throw InvalidProcessStateException();
 
-			static_assert((MaybeAuthority::count == 0) || MaybeAuthority::is_subset_of<T...>::value, "Authority components must be selected.");
-			static_assert(!MaybeOptional::is_subset_of<T...>::value, "Optional components must not be selected.");
+			using Selected = typename detail::selected_components<T...>::type;
+			static_assert(detail::is_type_subset<MaybeAuthority, Selected>::value, "Authority components must be selected.");
+			static_assert((MaybeOptional::count == 0) || !detail::is_type_subset<MaybeOptional, Selected>::value, "Optional components must not be selected.");
 			static_assert(MaybeOptional::is_subset_of<ComponentTypes...>::value, "Optional components must all be present in the container.");
-			static_assert(type_tuple<T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+			static_assert(detail::is_type_subset<Selected, ComponentsTypeTuple>::value, "Selected components must all be present in the container.");
+			static_assert(detail::is_type_subset<typename detail::excluded_components<T...>::type, ComponentsTypeTuple>::value, "Excluded components must all be present in the container.");
 
 			MaybeAuthority::for_each(RequestAuthority(this, authority_source));
-			return ComponentIterator<MaybeAuthority, MaybeOptional, ComponentSet<T...>>(this);
+			return FilteredComponentIterator<MaybeAuthority, MaybeOptional, T...>(this);
 		}
 
 		template<typename MaybeAuthority, typename MaybeOptional, typename... T>
 		typename std::enable_if<is_type_tuple<MaybeAuthority>::value && is_type_tuple<MaybeOptional>::value,
-			ComponentIterator<MaybeAuthority, MaybeOptional, ComponentSet<T...>>>::type GetComponentIterator(const std::initializer_list<void*>& authority_source)
+			FilteredComponentIterator<MaybeAuthority, MaybeOptional, T...>>::type GetComponentIterator(const std::initializer_list<void*>& authority_source)
 		{
 			if (!mProcessing)
 				throw InvalidProcessStateException();
 
-			static_assert((MaybeAuthority::count == 0) || MaybeAuthority::is_subset_of<T...>::value, "Authority components must be selected.");
-			static_assert(!MaybeOptional::is_subset_of<T...>::value, "Optional components must not be selected.");
+			using Selected = typename detail::selected_components<T...>::type;
+			static_assert(detail::is_type_subset<MaybeAuthority, Selected>::value, "Authority components must be selected.");
+			static_assert((MaybeOptional::count == 0) || !detail::is_type_subset<MaybeOptional, Selected>::value, "Optional components must not be selected.");
 			static_assert(MaybeOptional::is_subset_of<ComponentTypes...>::value, "Optional components must all be present in the container.");
-			static_assert(type_tuple<T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+			static_assert(detail::is_type_subset<Selected, ComponentsTypeTuple>::value, "Selected components must all be present in the container.");
+			static_assert(detail::is_type_subset<typename detail::excluded_components<T...>::type, ComponentsTypeTuple>::value, "Excluded components must all be present in the container.");
 			static_assert((MaybeAuthority::size + MaybeOptional::size + sizeof...(T)) == authority_source.size(), "Authority source size must equal the number of components");
 			//static_assert((MaybeAuthority::size) == authority_source.size(), "Authority source size must equal the number of components");
 			// VS is being dumb and the above doesn't work because ???
 			verify((MaybeAuthority::size) == authority_source.size());
 
 			MaybeAuthority::for_each(RequestAuthority(this, authority_source));
-			return ComponentIterator<MaybeAuthority, MaybeOptional, ComponentSet<T...>>(this);
+			return FilteredComponentIterator<MaybeAuthority, MaybeOptional, T...>(this);
 		}
 
 		template<typename MaybeAuthority, typename MaybeOptional, typename... T>
 		typename std::enable_if<is_type_tuple<MaybeAuthority>::value && !is_type_tuple<MaybeOptional>::value,
-			ComponentIterator<MaybeAuthority, OptionalSet<>, ComponentSet<MaybeOptional, T...>>>::type GetComponentIterator(void* authority_source = nullptr)
+			FilteredComponentIterator<MaybeAuthority, OptionalSet<>, MaybeOptional, T...>>::type GetComponentIterator(void* authority_source = nullptr)
 		{
 			if (!mProcessing)
 				throw InvalidProcessStateException();
 
-			static_assert(MaybeAuthority::is_subset_of<MaybeOptional, T...>::value, "Authority components must be selected.");
-			static_assert(type_tuple<MaybeOptional, T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+			using Selected = typename detail::selected_components<MaybeOptional, T...>::type;
+			static_assert(detail::is_type_subset<MaybeAuthority, Selected>::value, "Authority components must be selected.");
+			static_assert(detail::is_type_subset<Selected, ComponentsTypeTuple>::value, "Selected components must all be present in the container.");
+			static_assert(detail::is_type_subset<typename detail::excluded_components<MaybeOptional, T...>::type, ComponentsTypeTuple>::value, "Excluded components must all be present in the container.");
 
 			MaybeAuthority::for_each(RequestAuthority(this, authority_source));
-			return ComponentIterator<MaybeAuthority, OptionalSet<>, ComponentSet<MaybeOptional, T...>>(this);
+			return FilteredComponentIterator<MaybeAuthority, OptionalSet<>, MaybeOptional, T...>(this);
 		}
 
 		template<typename MaybeAuthority, typename MaybeOptional, typename... T>
 		typename std::enable_if<is_type_tuple<MaybeAuthority>::value && !is_type_tuple<MaybeOptional>::value,
-			ComponentIterator<MaybeAuthority, OptionalSet<>, ComponentSet<MaybeOptional, T...>>>::type GetComponentIterator(const std::initializer_list<void*>& authority_source)
+			FilteredComponentIterator<MaybeAuthority, OptionalSet<>, MaybeOptional, T...>>::type GetComponentIterator(const std::initializer_list<void*>& authority_source)
 		{
 			if (!mProcessing)
 				throw InvalidProcessStateException();
 
-			static_assert(MaybeAuthority::is_subset_of<MaybeOptional, T...>::value, "Authority components must be selected.");
-			static_assert(type_tuple<MaybeOptional, T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+			using Selected = typename detail::selected_components<MaybeOptional, T...>::type;
+			static_assert(detail::is_type_subset<MaybeAuthority, Selected>::value, "Authority components must be selected.");
+			static_assert(detail::is_type_subset<Selected, ComponentsTypeTuple>::value, "Selected components must all be present in the container.");
+			static_assert(detail::is_type_subset<typename detail::excluded_components<MaybeOptional, T...>::type, ComponentsTypeTuple>::value, "Excluded components must all be present in the container.");
 			//static_assert((MaybeAuthority::size) == authority_source.size(), "Authority source size must equal the number of components");
 			// VS is being dumb and the above doesn't work because ???
 			verify((MaybeAuthority::size) == authority_source.size());
 
 			MaybeAuthority::for_each(RequestMultiAuthority(this, authority_source));
-			return ComponentIterator<MaybeAuthority, OptionalSet<>, ComponentSet<MaybeOptional, T...>>(this);
+			return FilteredComponentIterator<MaybeAuthority, OptionalSet<>, MaybeOptional, T...>(this);
 		}
 
 		template<typename MaybeOptional, typename... T>
 		typename std::enable_if <is_type_tuple<MaybeOptional>::value,
-			ComponentIterator<AuthoritySet<>, MaybeOptional, ComponentSet<T...>> > ::type GetReadComponentIterator()
+			FilteredComponentIterator<AuthoritySet<>, MaybeOptional, T...> > ::type GetReadComponentIterator()
 		{
-			static_assert(!MaybeOptional::is_subset_of<T...>::value, "Optional components must not be selected.");
-			static_assert(type_tuple<T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container."); 
+			using Selected = typename detail::selected_components<T...>::type;
+			static_assert((MaybeOptional::count == 0) || !detail::is_type_subset<MaybeOptional, Selected>::value, "Optional components must not be selected.");
+			static_assert(detail::is_type_subset<Selected, ComponentsTypeTuple>::value, "Selected components must all be present in the container.");
+			static_assert(detail::is_type_subset<typename detail::excluded_components<T...>::type, ComponentsTypeTuple>::value, "Excluded components must all be present in the container.");
 			static_assert(MaybeOptional::is_subset_of<ComponentTypes...>::value, "Optional components must all be present in the container.");
 
-			return ComponentIterator<AuthoritySet<>, MaybeOptional, ComponentSet<T...>>(this);
+			return FilteredComponentIterator<AuthoritySet<>, MaybeOptional, T...>(this);
 		}
 
 		template<typename MaybeOptional, typename... T>
 		typename std::enable_if <!is_type_tuple<MaybeOptional>::value,
-			ComponentIterator<AuthoritySet<>, OptionalSet<>, ComponentSet<MaybeOptional, T...>> > ::type GetReadComponentIterator()
+			FilteredComponentIterator<AuthoritySet<>, OptionalSet<>, MaybeOptional, T...> > ::type GetReadComponentIterator()
 		{
-			static_assert(type_tuple<MaybeOptional, T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+			static_assert(detail::is_type_subset<typename detail::selected_components<MaybeOptional, T...>::type, ComponentsTypeTuple>::value, "Selected components must all be present in the container.");
+			static_assert(detail::is_type_subset<typename detail::excluded_components<MaybeOptional, T...>::type, ComponentsTypeTuple>::value, "Excluded components must all be present in the container.");
 
-			return ComponentIterator<AuthoritySet<>, OptionalSet<>, ComponentSet<MaybeOptional, T...>>(this);
+			return FilteredComponentIterator<AuthoritySet<>, OptionalSet<>, MaybeOptional, T...>(this);
 		}
 
-		inline void* GetUserPointer() const final
+		/// Calls fn(components...) for every entity that has all of the selected components, with the first component
+		/// of each type. Authority is requested like GetComponentIterator does, authority components are passed as
+		/// mutable references to the future buffer and the others as const references to the present buffer.
+		/// Unlike iterators the sorted buffers are walked directly and nothing is validated per entity, a single
+		/// component type whose components all belong to different entities is walked like a plain array.
+		/// Entities whose authority components were removed this tick are skipped.
+		template<typename MaybeAuthority, typename... T, typename Fn>
+		typename std::enable_if<is_type_tuple<MaybeAuthority>::value>::type ForEach(Fn&& fn, void* authority_source = nullptr)
 		{
-			return mUserPtr;
+			if (!mProcessing)
+				throw InvalidProcessStateException();
+
+			static_assert(sizeof...(T) > 0, "At least one component must be selected.");
+			static_assert((MaybeAuthority::count == 0) || MaybeAuthority::is_subset_of<T...>::value, "Authority components must be selected.");
+			static_assert(type_tuple<T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+			static_assert(!detail::any_soa<T...>::value, "Components with SoA fields aren't stored as a whole, use ForEachChunk.");
+
+			MaybeAuthority::for_each(RequestAuthority(this, authority_source));
+			ForEachImpl<MaybeAuthority, T...>(fn, std::integral_constant<bool, sizeof...(T) == 1>());
 		}
 
-		inline void SetUserPointer(void* ptr) final
+		/// Read only version of ForEach, every component is passed as a const reference to the present buffer.
+		template<typename MaybeAuthority, typename... T, typename Fn>
+		typename std::enable_if<!is_type_tuple<MaybeAuthority>::value>::type ForEach(Fn&& fn)
 		{
-			mUserPtr = ptr;
+			static_assert(type_tuple<MaybeAuthority, T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+			static_assert(!detail::any_soa<MaybeAuthority, T...>::value, "Components with SoA fields aren't stored as a whole, use ForEachChunk.");
+
+			ForEachImpl<AuthoritySet<>, MaybeAuthority, T...>(fn, std::integral_constant<bool, sizeof...(T) == 0>());
 		}
-	private:
-		// Workaround for an ICE
-		template<typename T>
-		inline void AddComponentImpl(size_t entityGuid, int entityIndex, int uservalue, size_t dist, T data)
+
+		/// Same as ForEach but the matches are split in chunks which are spread over the dispatcher's threads, fn is
+		/// called concurrently and must not throw. Chunks of a single directly walked type span a multiple of 64
+		/// components, so with a 64 byte aligned allocator (see aligned_arena.h) they never share cache lines.
+		template<typename MaybeAuthority, typename... T, typename Fn>
+		typename std::enable_if<is_type_tuple<MaybeAuthority>::value>::type ParallelForEach(Fn&& fn, void* authority_source = nullptr)
 		{
-			for (auto& comp : mPendingComponentActions)
-			{
-				if (comp.data.which() == sizeof...(ComponentTypes))
-				{
-					if (comp.data.get<detail::RemovalAction>().id == T::Id())
-					{
-						if (dist <= comp.index)
-							comp.index++;
-					}
-				}
-				else if (comp.data.which() == ComponentsTypeTuple::index_of<T>::value)
-				{
-					if (dist <= comp.index)
-						comp.index++;
-				}
-			}
+			if (!mProcessing)
+				throw InvalidProcessStateException();
+
+			static_assert(sizeof...(T) > 0, "At least one component must be selected.");
+			static_assert((MaybeAuthority::count == 0) || MaybeAuthority::is_subset_of<T...>::value, "Authority components must be selected.");
+			static_assert(type_tuple<T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+			static_assert(!detail::any_soa<T...>::value, "Components with SoA fields aren't stored as a whole, use ForEachChunk.");
+
+			MaybeAuthority::for_each(RequestAuthority(this, authority_source));
+			ParallelForEachImpl<MaybeAuthority, T...>(fn, std::integral_constant<bool, sizeof...(T) == 1>());
 		}
 
-		template<typename T, typename ContainerType>
-		T* GetComponentInContainer(EntityRef ent, ContainerType& container, unsigned char idx = 0)
+		/// Read only version of ParallelForEach
+		template<typename MaybeAuthority, typename... T, typename Fn>
+		typename std::enable_if<!is_type_tuple<MaybeAuthority>::value>::type ParallelForEach(Fn&& fn)
 		{
-			auto* entp = FindEntityPtr(ent.Guid);
-			if (!entp)
-				return nullptr;
+			static_assert(type_tuple<MaybeAuthority, T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+			static_assert(!detail::any_soa<MaybeAuthority, T...>::value, "Components with SoA fields aren't stored as a whole, use ForEachChunk.");
 
-			if (idx >= entp->ComponentCount[ComponentsTypeTuple::index_of<T>::value])
+			ParallelForEachImpl<AuthoritySet<>, MaybeAuthority, T...>(fn, std::integral_constant<bool, sizeof...(T) == 0>());
+		}
+
+		/// Contiguous components ForEachChunk hands its callback. The components of every selected type belong to the
+		/// same Size() entities, grouped by entity in the same order for every type. Editable types are read from and
+		/// written to the future buffer, the others are read from the present buffer.
+		template<typename AuthSet, typename... T>
+		class ComponentChunk {
+			using Selected = type_tuple<T...>;
+
+			BasicWorld* mOwner;
+			size_t mSize;
+			size_t mFirst[sizeof...(T)];
+			size_t mCount[sizeof...(T)];
+
+			template<typename U>
+			using BufferOf = typename Container<U>::BufferType;
+
+			template<typename U>
+			inline BufferOf<U>& Buffer() const
 			{
-				return nullptr;
+				auto& components = std::get<Container<U>>(mOwner->mComponents);
+				return AuthSet::template contains<U>::value ? components.GetFutureBuffer() : components.PresentBuffer;
 			}
-			else
+
+			template<typename U>
+			inline int MarkEdited()
 			{
-				auto it = FindFirstComponentBelongingToEntity(container, *entp);
+				if (AuthSet::template contains<U>::value)
+				{
+					auto& components = std::get<Container<U>>(mOwner->mComponents);
+					size_t index = Selected::template index_of<U>::value;
 
-				if (it != container.end())
-					return &*(it + idx);
-				else
-					return nullptr;
+					components.MarkFutureRangeDirty(mFirst[index], mCount[index]);
+					components.MarkRangeChanged(mFirst[index], mCount[index], mOwner->GetWriteVersion());
+				}
+
+				return 0;
+			}
+		public:
+			ComponentChunk(BasicWorld* owner, size_t size, const size_t* first, const size_t* count) : mOwner(owner), mSize(size)
+			{
+				for (size_t n = 0; n < sizeof...(T); n++)
+				{
+					mFirst[n] = first[n];
+					mCount[n] = count[n];
+				}
+
+				(void) std::initializer_list<int>{ MarkEdited<T>()... };
+			}
+
+			/// Number of entities in the chunk
+			inline size_t Size() const
+			{
+				return mSize;
+			}
+
+			/// Number of components of type U in the chunk, a multiple of Size()
+			template<typename U>
+			inline size_t Count() const
+			{
+				static_assert(Selected::template contains<U>::value, "U must be one of the selected components.");
+				return mCount[Selected::template index_of<U>::value];
+			}
+
+			/// The chunk's components of a type without SoA fields
+			template<typename U>
+			inline const U* Column() const
+			{
+				static_assert(Selected::template contains<U>::value, "U must be one of the selected components.");
+				static_assert(!component_traits<U>::soa, "Components with SoA fields aren't stored as a whole, use Field.");
+				return Buffer<U>().data() + mFirst[Selected::template index_of<U>::value];
+			}
+
+			template<typename U>
+			inline U* EditColumn() const
+			{
+				static_assert(AuthSet::template contains<U>::value, "U must be one of the editable components.");
+				static_assert(!component_traits<U>::soa, "Components with SoA fields aren't stored as a whole, use EditField.");
+				return Buffer<U>().data() + mFirst[Selected::template index_of<U>::value];
+			}
+
+			/// The chunk's values of one of the fields listed in U's COMPONENT_SOA_FIELDS, Count<U>() contiguous values
+			/// which start on a 64 byte boundary whenever the chunk starts on a multiple of 64 components.
+			/// Returns null for fields that aren't listed.
+			template<typename U, typename M>
+			inline const M* Field(M U::* field) const
+			{
+				static_assert(Selected::template contains<U>::value, "U must be one of the selected components.");
+				static_assert(component_traits<U>::soa, "Only components with SoA fields have per field arrays, use Column.");
+				const M* values = Buffer<U>().GetField(field);
+				return values ? values + mFirst[Selected::template index_of<U>::value] : nullptr;
+			}
+
+			template<typename U, typename M>
+			inline M* EditField(M U::* field) const
+			{
+				static_assert(AuthSet::template contains<U>::value, "U must be one of the editable components.");
+				static_assert(component_traits<U>::soa, "Only components with SoA fields have per field arrays, use EditColumn.");
+				M* values = Buffer<U>().GetField(field);
+				return values ? values + mFirst[Selected::template index_of<U>::value] : nullptr;
 			}
+		};
+
+		/// Calls fn(chunk) with ComponentChunk<AuthoritySet, T...> views covering every entity that has all of the
+		/// selected components, which is the only way to iterate components with SoA fields. Authority is requested
+		/// like ForEach does. Chunks follow the archetypes when they describe the buffers' layout, single component
+		/// types whose components all belong to different entities are split in runs of up to 1024 components, and
+		/// otherwise every chunk holds a single entity's components.
+		template<typename MaybeAuthority, typename... T, typename Fn>
+		typename std::enable_if<is_type_tuple<MaybeAuthority>::value>::type ForEachChunk(Fn&& fn, void* authority_source = nullptr)
+		{
+			if (!mProcessing)
+				throw InvalidProcessStateException();
+
+			static_assert(sizeof...(T) > 0, "At least one component must be selected.");
+			static_assert((MaybeAuthority::count == 0) || MaybeAuthority::is_subset_of<T...>::value, "Authority components must be selected.");
+			static_assert(type_tuple<T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+
+			MaybeAuthority::for_each(RequestAuthority(this, authority_source));
+			ForEachChunkImpl<MaybeAuthority, T...>(fn, false);
 		}
 
-		template<typename T>
-		inline void* GetRawComponentImpl(EntityRef ent, size_t componentId, unsigned char idx = 0)
+		/// Read only version of ForEachChunk
+		template<typename MaybeAuthority, typename... T, typename Fn>
+		typename std::enable_if<!is_type_tuple<MaybeAuthority>::value>::type ForEachChunk(Fn&& fn)
 		{
-			if (T::Id() == componentId)
-				return GetComponent<T>(ent, idx);
-			else
-				return nullptr;
+			static_assert(type_tuple<MaybeAuthority, T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+
+			ForEachChunkImpl<AuthoritySet<>, MaybeAuthority, T...>(fn, false);
 		}
 
-		template<typename T, typename U, typename... V>
-		inline void* GetRawComponentImpl(EntityRef ent, size_t componentId, unsigned char idx = 0)
+		/// Same as ForEachChunk but the chunks are spread over the dispatcher's threads, fn is called concurrently and
+		/// must not throw.
+		template<typename MaybeAuthority, typename... T, typename Fn>
+		typename std::enable_if<is_type_tuple<MaybeAuthority>::value>::type ParallelForEachChunk(Fn&& fn, void* authority_source = nullptr)
 		{
-			if (T::Id() == componentId)
-				return GetComponent<T>(ent, idx);
-			else
-				return GetRawComponentImpl<U, V...>(ent, componentId, idx);
+			if (!mProcessing)
+				throw InvalidProcessStateException();
+
+			static_assert(sizeof...(T) > 0, "At least one component must be selected.");
+			static_assert((MaybeAuthority::count == 0) || MaybeAuthority::is_subset_of<T...>::value, "Authority components must be selected.");
+			static_assert(type_tuple<T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+
+			MaybeAuthority::for_each(RequestAuthority(this, authority_source));
+			ForEachChunkImpl<MaybeAuthority, T...>(fn, true);
 		}
 
-		template<typename T>
-		inline unsigned char CountRawComponentsImpl(EntityRef ent, size_t componentId) const
+		/// Read only version of ParallelForEachChunk
+		template<typename MaybeAuthority, typename... T, typename Fn>
+		typename std::enable_if<!is_type_tuple<MaybeAuthority>::value>::type ParallelForEachChunk(Fn&& fn)
 		{
-			if (T::Id() == componentId)
-				return CountComponents<T>(ent);
+			static_assert(type_tuple<MaybeAuthority, T...>::is_subset_of<ComponentTypes...>::value, "Selected components must all be present in the container.");
+
+			ForEachChunkImpl<AuthoritySet<>, MaybeAuthority, T...>(fn, true);
+		}
+
+		inline void* GetUserPointer() const final
+		{
+			return mUserPtr;
+		}
+
+		inline void SetUserPointer(void* ptr) final
+		{
+			mUserPtr = ptr;
+		}
+	private:
+		// Cursor over the buffer ForEach passes one of its component types from
+		template<typename AuthSet, typename T>
+		struct ForEachColumn {
+			static const bool Editable = AuthSet::template contains<T>::value;
+			using Reference = typename std::conditional<Editable, T&, const T&>::type;
+
+			Container<T>& Components;
+			typename std::conditional<Editable, T*, const T*>::type Data;
+			size_t Size;
+			size_t Cursor;
+			unsigned Version;
+
+			ForEachColumn(Container<T>& components, unsigned version) : Components(components), Cursor(0), Version(version)
+			{
+				auto& buffer = Editable ? components.GetFutureBuffer() : components.PresentBuffer;
+				Data = buffer.data();
+				Size = buffer.size();
+			}
+
+			// Starts at the first component belonging to entity_index or to a following entity
+			inline void SeekStart(size_t entity_index)
+			{
+				Cursor = std::distance(Data, std::lower_bound(Data, Data + Size, entity_index, [](const T& component, size_t index) {
+					return component.OwnerIndex < index;
+				}));
+			}
+
+			// Moves to the entity's first component, returns false if it has none
+			inline bool Seek(size_t entity_index)
+			{
+				Cursor = SeekComponentOwner(Data, Size, Cursor, entity_index);
+				return (Cursor < Size) && (Data[Cursor].OwnerIndex == entity_index);
+			}
+
+			// Components of entity_index from the cursor on, once Seek found it
+			inline size_t CountOwned(size_t entity_index) const
+			{
+				size_t end = Cursor;
+				while ((end < Size) && (Data[end].OwnerIndex == entity_index))
+					end++;
+
+				return end - Cursor;
+			}
+
+			// Moves to the first component of an archetype chunk, returns the components each of its entities has
+			inline size_t SeekChunk(const Archetype& archetype, const ArchetypeChunk& chunk)
+			{
+				const size_t type_index = ComponentsTypeTuple::template index_of<T>::value;
+				size_t stride = archetype.Counts[type_index];
+				Cursor = archetype.Offsets[type_index] + (chunk.FirstRow - archetype.FirstRow) * stride;
+
+				if (Editable)
+				{
+					Components.MarkFutureRangeDirty(Cursor, chunk.RowCount * stride);
+					Components.MarkRangeChanged(Cursor, chunk.RowCount * stride, Version);
+				}
+
+				return stride;
+			}
+
+			inline Reference Get()
+			{
+				if (Editable)
+				{
+					Components.MarkFutureDirty(Cursor);
+					Components.ChangedVersions.Mark(Data[Cursor].OwnerIndex, Version);
+				}
+
+				return Data[Cursor];
+			}
+		};
+
+		template<typename... Columns>
+		static inline bool SeekColumns(size_t entity_index, Columns&... columns)
+		{
+			bool found = true;
+			(void) std::initializer_list<int>{ (found = columns.Seek(entity_index) && found, 0)... };
+			return found;
+		}
+
+		// Merge joins the query's matches with every selected buffer, or sweeps the chunks of the matching archetypes
+		// when they describe the layout of every selected buffer
+		template<typename AuthSet, typename... T, typename Fn>
+		void ForEachImpl(Fn& fn, std::false_type)
+		{
+			static const ComponentMask signature = MakeForEachSignature<T...>();
+			const auto& query = AcquireQuery(signature);
+			std::tuple<ForEachColumn<AuthSet, T>...> columns(ForEachColumn<AuthSet, T>(std::get<Container<T>>(mComponents), GetWriteVersion())...);
+
+			if (SweepsArchetypes<AuthSet, T...>())
+			{
+				for (size_t chunk : query.Chunks)
+					SweepArchetypeChunk(fn, mArchetypeChunks[chunk], columns, std::index_sequence_for<T...>());
+
+				return;
+			}
+
+			ForEachJoin(fn, query.Matches.data(), query.Matches.data() + query.Matches.size(), columns, std::index_sequence_for<T...>());
+		}
+
+		// Whether the archetypes describe the layout of every buffer ForEach passes components from
+		template<typename AuthSet, typename... T>
+		inline bool SweepsArchetypes() const
+		{
+			const bool layouts[] = { (!AuthSet::template contains<T>::value || FutureHasPresentLayout<T>())... };
+			return StoragePolicy::clusters_archetypes && mArchetypesClustered && std::all_of(std::begin(layouts), std::end(layouts), [](bool layout) { return layout; });
+		}
+
+		template<typename Fn, typename ColumnTuple, size_t... Is>
+		void SweepArchetypeChunk(Fn& fn, const ArchetypeChunk& chunk, ColumnTuple& columns, std::index_sequence<Is...>)
+		{
+			const Archetype& archetype = mArchetypes[chunk.Archetype];
+			const size_t strides[] = { std::get<Is>(columns).SeekChunk(archetype, chunk)... };
+
+			for (size_t row = 0; row < chunk.RowCount; row++)
+				fn(std::get<Is>(columns).Data[std::get<Is>(columns).Cursor + row * strides[Is]]...);
+		}
+
+		template<typename Fn, typename ColumnTuple, size_t... Is>
+		static void ForEachJoin(Fn& fn, const size_t* first, const size_t* last, ColumnTuple& columns, std::index_sequence<Is...>)
+		{
+			for (; first != last; ++first)
+			{
+				if (SeekColumns(*first, std::get<Is>(columns)...))
+					fn(std::get<Is>(columns).Get()...);
+			}
+		}
+
+		// Single component types are walked directly when every component belongs to a different live entity and,
+		// for authority types, the future buffer still has the present buffer's layout
+		template<typename AuthSet, typename T, typename Fn>
+		void ForEachImpl(Fn& fn, std::true_type)
+		{
+			static const ComponentMask signature = MakeForEachSignature<T>();
+			auto& components = std::get<Container<T>>(mComponents);
+			const auto& matches = AcquireQuery(signature).Matches;
+			bool editable = AuthSet::template contains<T>::value;
+
+			if ((matches.size() != components.PresentBuffer.size()) ||
+				(editable && mComponentTypeRestructured[ComponentsTypeTuple::index_of<T>::value]))
+			{
+				std::tuple<ForEachColumn<AuthSet, T>> columns(ForEachColumn<AuthSet, T>(components, GetWriteVersion()));
+				ForEachJoin(fn, matches.data(), matches.data() + matches.size(), columns, std::index_sequence_for<T>());
+				return;
+			}
+
+			ForEachColumn<AuthSet, T> column(components, GetWriteVersion());
+
+			if (editable)
+			{
+				components.MarkFutureRangeDirty(0, column.Size);
+				components.MarkRangeChanged(0, column.Size, column.Version);
+			}
+
+			for (size_t n = 0; n < column.Size; n++)
+				fn(column.Data[n]);
+		}
+
+		// Components (or entities when joining) per ParallelForEach chunk, a multiple of 64
+		static const size_t kParallelForEachChunkSize = 1024;
+
+		template<typename Callable>
+		static void InvokeParallelChunk(void* context, size_t chunk)
+		{
+			(*static_cast<Callable*>(context))(chunk);
+		}
+
+		template<typename Callable>
+		inline void RunParallelChunks(size_t count, Callable& callable)
+		{
+			mDispatcher.ParallelFor((count + kParallelForEachChunkSize - 1) / kParallelForEachChunkSize, &InvokeParallelChunk<Callable>, &callable);
+		}
+
+		template<typename AuthSet, typename... T, typename Fn>
+		void ParallelForEachImpl(Fn& fn, std::false_type)
+		{
+			static const ComponentMask signature = MakeForEachSignature<T...>();
+			const auto& query = AcquireQuery(signature);
+			const auto& matches = query.Matches;
+
+			if (SweepsArchetypes<AuthSet, T...>())
+			{
+				auto run_archetype_chunk = [&](size_t chunk) {
+					std::tuple<ForEachColumn<AuthSet, T>...> columns(ForEachColumn<AuthSet, T>(std::get<Container<T>>(mComponents), GetWriteVersion())...);
+					SweepArchetypeChunk(fn, mArchetypeChunks[query.Chunks[chunk]], columns, std::index_sequence_for<T...>());
+				};
+
+				mDispatcher.ParallelFor(query.Chunks.size(), &InvokeParallelChunk<decltype(run_archetype_chunk)>, &run_archetype_chunk);
+				return;
+			}
+
+			auto run_chunk = [&](size_t chunk) {
+				size_t first = chunk * kParallelForEachChunkSize;
+				size_t last = std::min(first + kParallelForEachChunkSize, matches.size());
+				std::tuple<ForEachColumn<AuthSet, T>...> columns(ForEachColumn<AuthSet, T>(std::get<Container<T>>(mComponents), GetWriteVersion())...);
+
+				SeekColumnsStart(matches[first], columns, std::index_sequence_for<T...>());
+				ForEachJoin(fn, matches.data() + first, matches.data() + last, columns, std::index_sequence_for<T...>());
+			};
+
+			RunParallelChunks(matches.size(), run_chunk);
+		}
+
+		template<typename AuthSet, typename T, typename Fn>
+		void ParallelForEachImpl(Fn& fn, std::true_type)
+		{
+			static const ComponentMask signature = MakeForEachSignature<T>();
+			auto& components = std::get<Container<T>>(mComponents);
+			const auto& matches = AcquireQuery(signature).Matches;
+			bool editable = AuthSet::template contains<T>::value;
+
+			if ((matches.size() != components.PresentBuffer.size()) ||
+				(editable && mComponentTypeRestructured[ComponentsTypeTuple::index_of<T>::value]))
+			{
+				ParallelForEachImpl<AuthSet, T>(fn, std::false_type());
+				return;
+			}
+
+			ForEachColumn<AuthSet, T> column(components, GetWriteVersion());
+
+			auto run_chunk = [&](size_t chunk) {
+				size_t first = chunk * kParallelForEachChunkSize;
+				size_t last = std::min(first + kParallelForEachChunkSize, column.Size);
+
+				if (editable)
+				{
+					components.MarkFutureRangeDirty(first, last - first);
+					components.MarkRangeChanged(first, last - first, column.Version);
+				}
+
+				for (size_t n = first; n < last; n++)
+					fn(column.Data[n]);
+			};
+
+			RunParallelChunks(column.Size, run_chunk);
+		}
+
+		template<typename AuthSet, typename... T, typename Fn>
+		void ForEachChunkImpl(Fn& fn, bool parallel)
+		{
+			using Chunk = ComponentChunk<AuthSet, T...>;
+			static const ComponentMask signature = MakeForEachSignature<T...>();
+			const auto& query = AcquireQuery(signature);
+			const auto& matches = query.Matches;
+
+			if (SweepsArchetypes<AuthSet, T...>())
+			{
+				auto run_archetype_chunk = [&](size_t n) {
+					const ArchetypeChunk& chunk = mArchetypeChunks[query.Chunks[n]];
+					const Archetype& archetype = mArchetypes[chunk.Archetype];
+					const size_t first[] = { archetype.Offsets[ComponentsTypeTuple::index_of<T>::value] +
+						(chunk.FirstRow - archetype.FirstRow) * archetype.Counts[ComponentsTypeTuple::index_of<T>::value]... };
+					const size_t count[] = { chunk.RowCount * archetype.Counts[ComponentsTypeTuple::index_of<T>::value]... };
+
+					fn(Chunk(this, chunk.RowCount, first, count));
+				};
+
+				if (parallel)
+					mDispatcher.ParallelFor(query.Chunks.size(), &InvokeParallelChunk<decltype(run_archetype_chunk)>, &run_archetype_chunk);
+				else
+				{
+					for (size_t n = 0; n < query.Chunks.size(); n++)
+						run_archetype_chunk(n);
+				}
+
+				return;
+			}
+
+			if (ForEachChunkRun<AuthSet, T...>(fn, parallel, matches.size(), std::integral_constant<bool, sizeof...(T) == 1>()))
+				return;
+
+			// Every entity gets its own chunk, spanning all of its components of each type
+			auto run_join = [&](size_t n) {
+				size_t first_match = n * kParallelForEachChunkSize;
+				size_t last_match = std::min(first_match + kParallelForEachChunkSize, matches.size());
+				std::tuple<ForEachColumn<AuthSet, T>...> columns(ForEachColumn<AuthSet, T>(std::get<Container<T>>(mComponents), GetWriteVersion())...);
+
+				SeekColumnsStart(matches[first_match], columns, std::index_sequence_for<T...>());
+				ForEachJoinChunk<Chunk>(fn, matches.data() + first_match, matches.data() + last_match, columns, std::index_sequence_for<T...>());
+			};
+
+			if (parallel)
+				RunParallelChunks(matches.size(), run_join);
 			else
-				return 0;
+			{
+				for (size_t n = 0; n * kParallelForEachChunkSize < matches.size(); n++)
+					run_join(n);
+			}
 		}
 
-		template<typename T, typename U, typename... V>
-		inline unsigned char CountRawComponentsImpl(EntityRef ent, size_t componentId) const
+		// Single component types whose components all belong to different entities are split in runs of components,
+		// under the same conditions ForEachImpl walks them directly
+		template<typename AuthSet, typename T, typename Fn>
+		bool ForEachChunkRun(Fn& fn, bool parallel, size_t match_count, std::true_type)
 		{
-			if (T::Id() == componentId)
-				return CountComponents<T>(ent);
+			auto& components = std::get<Container<T>>(mComponents);
+
+			if ((match_count != components.PresentBuffer.size()) ||
+				(AuthSet::template contains<T>::value && mComponentTypeRestructured[ComponentsTypeTuple::index_of<T>::value]))
+				return false;
+
+			auto run_chunk = [&](size_t n) {
+				const size_t chunk_size = kParallelForEachChunkSize;
+				const size_t first[] = { n * chunk_size };
+				const size_t count[] = { std::min(match_count - first[0], chunk_size) };
+
+				fn(ComponentChunk<AuthSet, T>(this, count[0], first, count));
+			};
+
+			if (parallel)
+				RunParallelChunks(match_count, run_chunk);
 			else
-				return CountRawComponentsImpl<U, V...>(ent, componentId);
+			{
+				for (size_t n = 0; n * kParallelForEachChunkSize < match_count; n++)
+					run_chunk(n);
+			}
+
+			return true;
+		}
+
+		template<typename AuthSet, typename... T, typename Fn>
+		bool ForEachChunkRun(Fn&, bool, size_t, std::false_type)
+		{
+			return false;
+		}
+
+		template<typename Chunk, typename Fn, typename ColumnTuple, size_t... Is>
+		void ForEachJoinChunk(Fn& fn, const size_t* first, const size_t* last, ColumnTuple& columns, std::index_sequence<Is...>)
+		{
+			for (; first != last; ++first)
+			{
+				if (SeekColumns(*first, std::get<Is>(columns)...))
+				{
+					const size_t start[] = { std::get<Is>(columns).Cursor... };
+					const size_t count[] = { std::get<Is>(columns).CountOwned(*first)... };
+
+					fn(Chunk(this, 1, start, count));
+				}
+			}
+		}
+
+		template<typename ColumnTuple, size_t... Is>
+		static inline void SeekColumnsStart(size_t entity_index, ColumnTuple& columns, std::index_sequence<Is...>)
+		{
+			(void) std::initializer_list<int>{ (std::get<Is>(columns).SeekStart(entity_index), 0)... };
+		}
+
+		template<typename... T>
+		static ComponentMask MakeForEachSignature()
+		{
+			ComponentMaskBuilder builder;
+			type_tuple<T...>::for_each(builder);
+			return builder.Mask;
 		}
 
+		// Workaround for an ICE
 		template<typename T>
-		inline void* GetRawFutureComponentImpl(EntityRef ent, size_t componentId, unsigned char idx = 0)
+		inline void AddComponentImpl(size_t, int, int, size_t dist, T)
 		{
-			if (T::Id() == componentId)
-				return GetFutureComponent<T>(ent, idx);
-			else
-				return nullptr;
+			AddComponentImpl(std::get<ComponentActionQueue<T>>(mPendingComponentActions), dist);
+
+			for (auto& buffer : mCommandBuffers)
+				AddComponentImpl(std::get<ComponentActionQueue<T>>(buffer.ComponentActions), dist);
 		}
 
-		template<typename T, typename U, typename... V>
-		inline void* GetRawFutureComponentImpl(EntityRef ent, size_t componentId, unsigned char idx = 0)
+		/// Offsets the indices of every pending action for T by the number of components inserted at or
+		/// before them. Positions must be sorted and relative to the buffer before any insertion.
+		template<typename T>
+		void OffsetPendingComponentActions(ComponentActionQueue<T>& actions, const std::vector<size_t>& positions)
 		{
-			if (T::Id() == componentId)
-				return GetFutureComponent<T>(ent, idx);
-			else
-				return GetRawFutureComponentImpl<U, V...>(ent, componentId, idx);
+			for (auto& addition : actions.Additions)
+				addition.Index += std::distance(positions.begin(), std::upper_bound(positions.begin(), positions.end(), addition.Index));
+
+			for (auto& removal : actions.Removals)
+				removal.Index += std::distance(positions.begin(), std::upper_bound(positions.begin(), positions.end(), removal.Index));
 		}
 
 		template<typename T>
-		inline unsigned char CountRawFutureComponentsImpl(EntityRef ent, size_t componentId) const
+		inline void AddComponentImpl(ComponentActionQueue<T>& actions, size_t dist)
 		{
-			if (T::Id() == componentId)
-				return CountInternalComponents<T>(ent);
-			else
-				return 0;
+			for (auto& addition : actions.Additions)
+			{
+				if (dist <= addition.Index)
+					addition.Index++;
+			}
+
+			for (auto& removal : actions.Removals)
+			{
+				if (dist <= removal.Index)
+					removal.Index++;
+			}
 		}
 
-		template<typename T, typename U, typename... V>
-		inline unsigned char CountRawFutureComponentsImpl(EntityRef ent, size_t componentId) const
+		template<typename T, typename BufferType>
+		T* GetComponentInContainer(EntityRef ent, Container<T>& components, BufferType& container, unsigned char idx = 0)
 		{
-			if (T::Id() == componentId)
+			auto* entp = FindEntityPtr(ent.Guid);
+			if (!entp)
+				return nullptr;
+
+			if (idx >= entp->ComponentCount[ComponentsTypeTuple::index_of<T>::value])
+			{
+				return nullptr;
+			}
+			else
+			{
+				auto it = FindFirstComponent(components, container, *entp);
+
+				if (it != container.end())
+					return &*(it + idx);
+				else
+					return nullptr;
+			}
+		}
+
+		template<typename T>
+		inline void* GetRawComponentPtr(EntityRef ent, unsigned char idx, bool future, std::false_type)
+		{
+			if (future)
+				return GetFutureComponent<T>(ent, idx);
+			else
+				return GetComponent<T>(ent, idx);
+		}
+
+		// Components with SoA fields aren't stored as a whole, raw accessors don't find them
+		template<typename T>
+		inline void* GetRawComponentPtr(EntityRef, unsigned char, bool, std::true_type)
+		{
+			return nullptr;
+		}
+
+		template<typename T>
+		inline void* GetRawComponentImpl(EntityRef ent, size_t componentId, unsigned char idx = 0)
+		{
+			if (T::Id() == componentId)
+				return GetRawComponentPtr<T>(ent, idx, false, std::integral_constant<bool, component_traits<T>::soa>());
+			else
+				return nullptr;
+		}
+
+		template<typename T, typename U, typename... V>
+		inline void* GetRawComponentImpl(EntityRef ent, size_t componentId, unsigned char idx = 0)
+		{
+			if (T::Id() == componentId)
+				return GetRawComponentPtr<T>(ent, idx, false, std::integral_constant<bool, component_traits<T>::soa>());
+			else
+				return GetRawComponentImpl<U, V...>(ent, componentId, idx);
+		}
+
+		template<typename T>
+		inline unsigned char CountRawComponentsImpl(EntityRef ent, size_t componentId) const
+		{
+			if (T::Id() == componentId)
+				return CountComponents<T>(ent);
+			else
+				return 0;
+		}
+
+		template<typename T, typename U, typename... V>
+		inline unsigned char CountRawComponentsImpl(EntityRef ent, size_t componentId) const
+		{
+			if (T::Id() == componentId)
+				return CountComponents<T>(ent);
+			else
+				return CountRawComponentsImpl<U, V...>(ent, componentId);
+		}
+
+		template<typename T>
+		inline void* GetRawFutureComponentImpl(EntityRef ent, size_t componentId, unsigned char idx = 0)
+		{
+			if (T::Id() == componentId)
+				return GetRawComponentPtr<T>(ent, idx, true, std::integral_constant<bool, component_traits<T>::soa>());
+			else
+				return nullptr;
+		}
+
+		template<typename T, typename U, typename... V>
+		inline void* GetRawFutureComponentImpl(EntityRef ent, size_t componentId, unsigned char idx = 0)
+		{
+			if (T::Id() == componentId)
+				return GetRawComponentPtr<T>(ent, idx, true, std::integral_constant<bool, component_traits<T>::soa>());
+			else
+				return GetRawFutureComponentImpl<U, V...>(ent, componentId, idx);
+		}
+
+		template<typename T>
+		inline unsigned char CountRawFutureComponentsImpl(EntityRef ent, size_t componentId) const
+		{
+			if (T::Id() == componentId)
+				return CountInternalComponents<T>(ent);
+			else
+				return 0;
+		}
+
+		template<typename T, typename U, typename... V>
+		inline unsigned char CountRawFutureComponentsImpl(EntityRef ent, size_t componentId) const
+		{
+			if (T::Id() == componentId)
 				return CountInternalComponents<T>(ent);
 			else
 				return CountRawFutureComponentsImpl<U, V...>(ent, componentId);
 		}
 
-		void ExecutePendingUpdates()
+		void Initialize()
+		{
+			memset(mAuthorityExists, 0, sizeof(mAuthorityExists));
+			memset(mComponentTypeRestructured, 0, sizeof(mComponentTypeRestructured));
+			mCommandBuffers.resize(mDispatcher.GetThreadCount());
+			mActiveCommandBuffers.resize(mDispatcher.GetThreadCount());
+
+			for (size_t n = 0; n < mActiveCommandBuffers.size(); n++)
+				mActiveCommandBuffers[n] = n;
+		}
+
+		void AddProcessData(ProcessData procdata, size_t procGroup)
+		{
+			while (mProcessGroups.size() <= procGroup)
+			{
+				mProcessGroups.emplace_back();
+			}
+
+			procdata.Job.reset(new ProcessJob(this, procdata.Process));
+			mProcessGroups[procGroup].push_back(std::move(procdata));
+			mProcessWavesOutdated = true;
+		}
+
+		static bool ProcessesConflict(const ProcessData& a, const ProcessData& b, const ComponentMask& singleBuffered)
+		{
+			if (!a.DeclaresAccess || !b.DeclaresAccess)
+				return true;
+
+			// Readers of double buffered components only see the present buffer, which writers leave alone
+			return (a.Writes & b.Writes).any() || (a.Writes & b.Reads & singleBuffered).any() || (b.Writes & a.Reads & singleBuffered).any();
+		}
+
+		// Layers the processes of every group in waves, each of which is a single dispatcher batch. A process lands
+		// right after the last wave holding a process of another group it conflicts with, so processes that don't
+		// conflict with earlier groups run alongside them instead of waiting for them to finish.
+		void BuildProcessWaves()
+		{
+			static const bool single_buffered[] = { component_traits<ComponentTypes>::single_buffered... };
+
+			struct PlacedProcess {
+				const ProcessData* Data;
+				size_t Group;
+				size_t Wave;
+			};
+
+			ComponentMask single_buffered_mask;
+			std::vector<PlacedProcess> placed;
+
+			for (size_t n = 0; n < sizeof...(ComponentTypes); n++)
+				single_buffered_mask[n] = single_buffered[n];
+
+			mProcessWaves.clear();
+			size_t command_buffer = mDispatcher.GetThreadCount();
+
+			for (size_t group = 0; group < mProcessGroups.size(); group++)
+			{
+				for (auto& procdata : mProcessGroups[group])
+				{
+					size_t wave = 0;
+					procdata.Job->SetCommandBuffer(command_buffer++);
+
+					for (auto& other : placed)
+					{
+						if ((other.Group != group) && (other.Wave >= wave) && ProcessesConflict(*other.Data, procdata, single_buffered_mask))
+							wave = other.Wave + 1;
+					}
+
+					if (mProcessWaves.size() <= wave)
+						mProcessWaves.resize(wave + 1);
+
+					mProcessWaves[wave].push_back(&procdata);
+					placed.push_back({ &procdata, group, wave });
+				}
+			}
+
+			// Buffers are never dropped, they may still hold the changes of removed processes
+			if (mCommandBuffers.size() < command_buffer)
+				mCommandBuffers.resize(command_buffer);
+
+			mProcessWavesOutdated = false;
+		}
+
+		void ExecutePendingUpdates()
+		{
+			tuple_for_each(mComponents, AddPendingComponents(this));
+			UpdateSingleBufferedComponentBits();
+			mQueriesOutdated = true;
+			mArchetypesClustered = false;
+		}
+
+		/// Same as ExecutePendingUpdates but each component type is updated by a separate dispatcher job.
+		/// Must not be called while the dispatcher is executing.
+		void DispatchPendingUpdates()
+		{
+			static const typename HousekeepingJob::Callback callbacks[] = { &ApplyPendingComponentActions<ComponentTypes>... };
+
+			for (size_t n = 0; n < sizeof...(ComponentTypes); n++)
+			{
+				mComponentJobs[n].Set(this, callbacks[n], 0);
+				mDispatcher.Schedule(&mComponentJobs[n]);
+			}
+
+			mDispatcher.Execute();
+			UpdateSingleBufferedComponentBits();
+			mQueriesOutdated = true;
+		}
+
+		/// Swaps the buffers of every component type and publishes the internal component counts of every entity,
+		/// with one dispatcher job per type and per range of entities.
+		void DispatchBufferSwap()
+		{
+			static const typename HousekeepingJob::Callback callbacks[] = { &SwapComponentBuffers<ComponentTypes>... };
+			size_t entity_jobs = (mEntities.size() + kEntitiesPerHousekeepingJob - 1) / kEntitiesPerHousekeepingJob;
+
+			for (size_t n = 0; n < sizeof...(ComponentTypes); n++)
+			{
+				mComponentJobs[n].Set(this, callbacks[n], 0);
+				mDispatcher.Schedule(&mComponentJobs[n]);
+			}
+
+			while (mEntityJobs.size() < entity_jobs)
+				mEntityJobs.emplace_back(new HousekeepingJob());
+
+			for (size_t n = 0; n < entity_jobs; n++)
+			{
+				mEntityJobs[n]->Set(this, &PublishComponentCounts, n);
+				mDispatcher.Schedule(mEntityJobs[n].get());
+			}
+
+			mDispatcher.Execute();
+		}
+
+		template<typename T>
+		static void ApplyPendingComponentActions(BasicWorld* world, size_t)
+		{
+			AddPendingComponents functor(world);
+			functor(std::get<Container<T>>(world->mComponents));
+		}
+
+		template<typename T>
+		static void SwapComponentBuffers(BasicWorld* world, size_t)
+		{
+			SwapBuffers functor;
+			functor(std::get<Container<T>>(world->mComponents));
+		}
+
+		static void PublishComponentCounts(BasicWorld* world, size_t slice)
+		{
+			size_t first = slice * kEntitiesPerHousekeepingJob;
+			size_t last = std::min(first + kEntitiesPerHousekeepingJob, world->mEntities.size());
+
+			for (size_t n = first; n < last; n++)
+			{
+				auto& entity = world->mEntities[n];
+
+				if (memcmp(entity.ComponentCount, entity.InternalComponentCount, sizeof(entity.InternalComponentCount)) != 0)
+				{
+					memcpy(entity.ComponentCount, entity.InternalComponentCount, sizeof(entity.InternalComponentCount));
+					UpdateComponentBits(entity);
+				}
+			}
+		}
+
+		// Single buffered types change the present counts of the entities they touch while their pending actions are
+		// applied, one job per type. The presence bits of every type share the same words so they're only brought
+		// in line afterwards, once all the jobs are done.
+		void UpdateSingleBufferedComponentBits()
+		{
+			static const bool single_buffered[] = { component_traits<ComponentTypes>::single_buffered... };
+
+			for (size_t type_index = 0; type_index < sizeof...(ComponentTypes); type_index++)
+			{
+				if (single_buffered[type_index])
+				{
+					for (size_t index : mTouchedEntitiesByType[type_index])
+						UpdateComponentBits(mEntities[index]);
+				}
+			}
+		}
+
+		/// Moves the actions for T recorded in each command buffer into the pending queue, in buffer order, and sorts them.
+		/// Actions targeting entities that no longer exist (or never got added) are dropped, entity removals have
+		/// already queued the removal of all their components.
+		template<typename T>
+		ComponentActionQueue<T>& CollectPendingComponentActions()
+		{
+			using Removal = typename ComponentActionQueue<T>::Removal;
+			auto& pending = std::get<ComponentActionQueue<T>>(mPendingComponentActions);
+
+			for (auto& buffer : mCommandBuffers)
+			{
+				auto& actions = std::get<ComponentActionQueue<T>>(buffer.ComponentActions);
+
+				for (auto& addition : actions.Additions)
+				{
+					if (FindEntityPtr(addition.OwnerGuid))
+						pending.Additions.push_back(addition);
+				}
+
+				for (auto& removal : actions.Removals)
+				{
+					if (FindEntityPtr(removal.OwnerGuid))
+						pending.Removals.push_back(removal);
+				}
+
+				actions.Additions.clear();
+				actions.Removals.clear();
+			}
+
+			auto& scratch = std::get<ComponentActionQueue<T>>(mComponentActionScratch);
+			detail::SortComponentActions(pending.Additions, scratch.Additions);
+			detail::SortComponentActions(pending.Removals, scratch.Removals);
+
+			// Several threads may have requested the removal of the same component
+			pending.Removals.erase(std::unique(pending.Removals.begin(), pending.Removals.end(), [](const Removal& lhs, const Removal& rhs) {
+				return (lhs.Index == rhs.Index) && (lhs.Length == rhs.Length) && (lhs.OwnerGuid == rhs.OwnerGuid);
+			}), pending.Removals.end());
+
+			return pending;
+		}
+
+		/// Attempts to find an entity that has the specified GUID in the current entities vector.
+		/// The slot index is encoded in the GUID so this is a constant time lookup. Pending guids of the entities
+		/// added when the current tick started are resolved to their final guid first.
+		inline const EntityType* FindEntityPtr(size_t guid) const
+		{
+			if (IsPendingEntityGuid(guid))
+				guid = ResolvePendingEntityGuid(guid);
+
+			size_t index = GetEntityRow(guid);
+
+			if ((index >= mEntities.size()) || (mEntities[index].Guid != guid))
+				return nullptr;
+			else
+				return &mEntities[index];
+		}
+
+		/// Attempts to find an entity that has the specified GUID in the current entities vector.
+		/// The slot index is encoded in the GUID so this is a constant time lookup. Pending guids of the entities
+		/// added when the current tick started are resolved to their final guid first.
+		inline EntityType* FindEntityPtr(size_t guid)
+		{
+			if (IsPendingEntityGuid(guid))
+				guid = ResolvePendingEntityGuid(guid);
+
+			size_t index = GetEntityRow(guid);
+
+			if ((index >= mEntities.size()) || (mEntities[index].Guid != guid))
+				return nullptr;
+			else
+				return &mEntities[index];
+		}
+
+		/// Searches for an entity in the current entities vector.
+		/// If the entity's not found it then attempts to search on the pending additions.
+		/// NOTE: Pending additions are only safe to inspect while no processes are executing.
+		const EntityType* FindEntityPtrExt(size_t guid) const
+		{
+			if (const EntityType* ret = FindEntityPtr(guid))
+			{
+				return ret;
+			}
+			else
+			{
+				for (auto& buffer : mCommandBuffers)
+				{
+					for (auto& entity : buffer.EntityAdditions)
+					{
+						if (entity.Guid == guid)
+							return &entity;
+					}
+				}
+
+				return nullptr;
+			}
+		}
+
+		// Processes record into their own buffer while they execute (see ProcessJob), anything else into the
+		// calling thread's. Changes requested from ParallelForEach callbacks therefore end up in whichever buffer
+		// the thread running the chunk uses, in no particular order.
+		inline size_t GetCommandBufferIndex() const
+		{
+			return mActiveCommandBuffers[mDispatcher.GetCurrentThreadIndex()];
+		}
+
+		inline CommandBuffer& GetCommandBuffer()
+		{
+			return mCommandBuffers[GetCommandBufferIndex()];
+		}
+
+		// Pending guids have their top bit set, followed by the low bits of the tick they were handed out during, the
+		// command buffer and the position of the entity's addition. The tick bits keep a tick's pending guids apart
+		// from the previous tick's, which are still being resolved. Slot generations wrap around before the top bit.
+		static const size_t kPendingEntityGuidFlag = size_t(1) << (sizeof(size_t) * 8 - 1);
+		static const size_t kPendingEntityTickBits = (sizeof(size_t) > 4) ? 15 : 2;
+		static const size_t kPendingEntityTickShift = sizeof(size_t) * 8 - 1 - kPendingEntityTickBits;
+		static const size_t kPendingEntityTickMask = (size_t(1) << kPendingEntityTickBits) - 1;
+		static const size_t kEntityGenerationMask = ~size_t(0) >> (kEntityGuidIndexBits + 1);
+
+		static inline size_t MakePendingEntityGuid(unsigned tick, size_t buffer, size_t position)
+		{
+			return kPendingEntityGuidFlag | ((tick & kPendingEntityTickMask) << kPendingEntityTickShift) |
+				(buffer << kEntityGuidIndexBits) | ((position + 1) & kEntityGuidIndexMask);
+		}
+
+		static inline bool IsPendingEntityGuid(size_t guid)
+		{
+			return (guid & kPendingEntityGuidFlag) != 0;
+		}
+
+		// Whether a guid was handed out by QueueAddEntity during the tick being processed (or the one that just
+		// ended, between ticks), its entity doesn't have a slot yet
+		inline bool IsUnresolvedEntityGuid(size_t guid) const
+		{
+			return IsPendingEntityGuid(guid) && (((guid >> kPendingEntityTickShift) & kPendingEntityTickMask) == (GetWriteVersion() & kPendingEntityTickMask));
+		}
+
+		// Returns the final guid of an entity added when the current tick started, or kInvalidEntityGuid
+		inline size_t ResolvePendingEntityGuid(size_t guid) const
+		{
+			auto it = std::lower_bound(mPendingEntityGuids.begin(), mPendingEntityGuids.end(), guid, [](const std::pair<size_t, size_t>& entry, size_t pending) {
+				return entry.first < pending;
+			});
+
+			return ((it != mPendingEntityGuids.end()) && (it->first == guid)) ? it->second : kInvalidEntityGuid;
+		}
+
+		// Version to stamp writes with. Outside of ticks the present buffer is written to, which readers see from the
+		// next tick on just like the future buffer written to during ticks.
+		inline unsigned GetWriteVersion() const
+		{
+			return mProcessing ? mTickVersion : mTickVersion - 1;
+		}
+
+		// Keeps an entity's presence bit for a component type in line with its ComponentCount
+		static inline void SetComponentBit(EntityType& entity, size_t type_index, bool present)
+		{
+			std::uint64_t bit = std::uint64_t(1) << (type_index % 64);
+			auto& word = entity.ComponentBits[type_index / 64];
+			word = present ? (word | bit) : (word & ~bit);
+		}
+
+		// Recomputes every presence bit of an entity from its ComponentCount
+		static inline void UpdateComponentBits(EntityType& entity)
+		{
+			memset(entity.ComponentBits, 0, sizeof(entity.ComponentBits));
+
+			for (size_t type_index = 0; type_index < sizeof...(ComponentTypes); type_index++)
+			{
+				if (entity.ComponentCount[type_index] != 0)
+					entity.ComponentBits[type_index / 64] |= std::uint64_t(1) << (type_index % 64);
+			}
+		}
+
+		inline void TouchEntity(size_t index)
+		{
+			mTouchedEntities.push_back(index);
+			mQueriesOutdated = true;
+			mArchetypesClustered = false;
+		}
+
+		/// Returns the query matching the entities that have every component in signature and none in excluded,
+		/// creating it if needed. Threadsafe while processing, since entities and component counts don't change then.
+		const EntityQuery& AcquireQuery(const ComponentMask& signature, const ComponentMask& excluded = ComponentMask())
+		{
+			std::lock_guard<std::mutex> lock(mQueryMutex);
+
+			if (!mProcessing)
+				RefreshQueries(false);
+
+			for (auto& query : mQueries)
+			{
+				if ((query->Signature == signature) && (query->Excluded == excluded))
+					return *query;
+			}
+
+			std::unique_ptr<EntityQuery> query(new EntityQuery());
+			query->Signature = signature;
+			query->Excluded = excluded;
+			memset(query->RequiredBits, 0, sizeof(query->RequiredBits));
+			memset(query->ExcludedBits, 0, sizeof(query->ExcludedBits));
+
+			for (size_t n = 0; n < signature.size(); n++)
+			{
+				if (signature.test(n))
+					query->RequiredBits[n / 64] |= std::uint64_t(1) << (n % 64);
+				if (excluded.test(n))
+					query->ExcludedBits[n / 64] |= std::uint64_t(1) << (n % 64);
+			}
+
+			PlanQueryScan(*query);
+
+			if (mArchetypesClustered)
+				CollectQueryChunks(*query);
+
+			mQueries.push_back(std::move(query));
+			return *mQueries.back();
+		}
+
+		/// Fills a new query's matches. Only the owners of the smallest present buffer among the required components
+		/// can match, so that buffer drives the scan unless every entity would have to be visited anyway.
+		void PlanQueryScan(EntityQuery& query)
+		{
+			static const ComponentCounter counters[] = { &CountPresentComponents<ComponentTypes>... };
+			static const QueryScanner scanners[] = { &ScanComponentOwners<ComponentTypes>... };
+			size_t driver = sizeof...(ComponentTypes);
+			size_t driver_size = mEntities.size();
+
+			for (size_t n = 0; n < sizeof...(ComponentTypes); n++)
+			{
+				if (query.Signature.test(n))
+				{
+					size_t size = counters[n](this);
+
+					if (size < driver_size)
+					{
+						driver = n;
+						driver_size = size;
+					}
+				}
+			}
+
+			if (driver < sizeof...(ComponentTypes))
+			{
+				scanners[driver](this, query);
+			}
+			else
+			{
+				for (size_t n = 0; n < mEntities.size(); n++)
+				{
+					if (MatchesQuery(query, mEntities[n]))
+						query.Matches.push_back(n);
+				}
+			}
+		}
+
+		using ComponentCounter = size_t(*)(const BasicWorld*);
+		using QueryScanner = void(*)(const BasicWorld*, EntityQuery&);
+
+		template<typename T>
+		static size_t CountPresentComponents(const BasicWorld* world)
+		{
+			return std::get<Container<T>>(world->mComponents).PresentBuffer.size();
+		}
+
+		// Adds the matching owners of T's present components to a query, in order
+		template<typename T>
+		static void ScanComponentOwners(const BasicWorld* world, EntityQuery& query)
+		{
+			size_t previous = kInvalidEntityIndex;
+
+			for (auto& component : std::get<Container<T>>(world->mComponents).PresentBuffer)
+			{
+				if (component.OwnerIndex == previous)
+					continue;
+
+				previous = component.OwnerIndex;
+
+				if ((previous < world->mEntities.size()) && world->MatchesQuery(query, world->mEntities[previous]))
+					query.Matches.push_back(previous);
+			}
+		}
+
+		inline bool MatchesQuery(const EntityQuery& query, const EntityType& entity) const
+		{
+			return (entity.Guid != kInvalidEntityGuid) && MatchesQueryBits(query, entity.ComponentBits);
+		}
+
+		static inline bool MatchesQueryBits(const EntityQuery& query, const std::uint64_t* bits)
+		{
+			for (size_t word = 0; word < kComponentBitWords; word++)
+			{
+				if (((bits[word] & query.RequiredBits[word]) != query.RequiredBits[word]) ||
+					((bits[word] & query.ExcludedBits[word]) != 0))
+					return false;
+			}
+
+			return true;
+		}
+
+		/// Re-evaluates the touched entities against every query. The touched entities are only forgotten when
+		/// consumed, which must only happen once their component counts are final (at the end of a tick).
+		void RefreshQueries(bool consume)
+		{
+			if (!mQueriesOutdated)
+				return;
+
+			auto& touched = mQueryScratch;
+			touched.clear();
+
+			if (!mQueries.empty())
+			{
+				touched.assign(mTouchedEntities.begin(), mTouchedEntities.end());
+
+				for (auto& type_touched : mTouchedEntitiesByType)
+					touched.insert(touched.end(), type_touched.begin(), type_touched.end());
+
+				std::sort(touched.begin(), touched.end());
+				touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+			}
+
+			// Matches of untouched entities can't have changed
+			if (!touched.empty())
+			{
+				for (auto& query : mQueries)
+					MergeTouchedEntities(*query, touched);
+			}
+
+			if (consume)
+			{
+				mTouchedEntities.clear();
+
+				for (auto& type_touched : mTouchedEntitiesByType)
+					type_touched.clear();
+			}
+
+			mQueriesOutdated = false;
+		}
+
+		// Merges the previous matches with the touched entities that still match. The result is built in a scratch
+		// buffer that then takes the previous matches' place, so buffers are reused across queries and ticks.
+		void MergeTouchedEntities(EntityQuery& query, const Vector<size_t>& touched)
+		{
+			auto& matches = mQueryMergeScratch;
+			matches.clear();
+			matches.reserve(query.Matches.size() + touched.size());
+			auto current = query.Matches.cbegin();
+
+			for (size_t index : touched)
+			{
+				while ((current != query.Matches.cend()) && (*current < index))
+					matches.push_back(*current++);
+
+				if ((current != query.Matches.cend()) && (*current == index))
+					++current;
+
+				if ((index < mEntities.size()) && MatchesQuery(query, mEntities[index]))
+					matches.push_back(index);
+			}
+
+			matches.insert(matches.end(), current, query.Matches.cend());
+			query.Matches.swap(matches);
+		}
+
+		// Whether the pending actions of a double buffered type were applied this tick, its future buffer doesn't
+		// have the present buffer's layout then
+		inline bool AnyDoubleBufferedTypeRestructured() const
+		{
+			static const bool single_buffered[] = { component_traits<ComponentTypes>::single_buffered... };
+
+			for (size_t type_index = 0; type_index < sizeof...(ComponentTypes); type_index++)
+			{
+				if (!single_buffered[type_index] && mComponentTypeRestructured[type_index])
+					return true;
+			}
+
+			return false;
+		}
+
+		// Whether the entities must be clustered before the processes run: the archetypes were outdated by the last
+		// tick or by structural changes since, or a single buffered type changed its present buffer this tick
+		inline bool ArchetypesOutdated() const
+		{
+			static const bool single_buffered[] = { component_traits<ComponentTypes>::single_buffered... };
+
+			if (!mArchetypesClustered)
+				return true;
+
+			for (size_t type_index = 0; type_index < sizeof...(ComponentTypes); type_index++)
+			{
+				if (single_buffered[type_index] && mComponentTypeRestructured[type_index])
+					return true;
+			}
+
+			return false;
+		}
+
+		/// Moves the entities sharing their component counts next to each other (ArchetypeStorage only). Archetypes
+		/// follow each other in the order they first appear and keep the relative order of their rows, then come the
+		/// rows freed since the last clustering, whose components may still be in the present buffers. Older free rows
+		/// are dropped. Components, versions, queries and touched entities follow their rows, component types are
+		/// moved by separate dispatcher jobs. Only called right after the pending updates, no action is pending then.
+		void ClusterArchetypes()
+		{
+			const size_t row_count = mEntities.size();
+			auto& new_rows = mClusteredRows;
+			auto& row_archetypes = mEntityArchetypes;
+			size_t archetype = kInvalidArchetype;
+
+			mArchetypes.clear();
+			mArchetypeChunks.clear();
+			mArchetypeLookup.clear();
+			row_archetypes.resize(row_count);
+
+			for (size_t row = 0; row < row_count; row++)
+			{
+				const EntityType& entity = mEntities[row];
+
+				if (entity.Guid == kInvalidEntityGuid)
+				{
+					row_archetypes[row] = kInvalidArchetype;
+					continue;
+				}
+
+				// The rows of an archetype mostly follow each other already
+				if ((archetype == kInvalidArchetype) || (memcmp(mArchetypes[archetype].Counts, entity.ComponentCount, sizeof(entity.ComponentCount)) != 0))
+					archetype = AcquireArchetype(entity);
+
+				row_archetypes[row] = archetype;
+				mArchetypes[archetype].RowCount++;
+			}
+
+			size_t live_rows = 0;
+
+			for (auto& type : mArchetypes)
+			{
+				type.FirstRow = live_rows;
+				live_rows += type.RowCount;
+				type.RowCount = 0;
+			}
+
+			new_rows.assign(row_count, kInvalidEntityIndex);
+			bool moved = false;
+
+			for (size_t row = 0; row < row_count; row++)
+			{
+				if (row_archetypes[row] != kInvalidArchetype)
+				{
+					auto& type = mArchetypes[row_archetypes[row]];
+					new_rows[row] = type.FirstRow + type.RowCount++;
+					moved = moved || (new_rows[row] != row);
+				}
+			}
+
+			std::sort(mFreedEntityRows.begin(), mFreedEntityRows.end());
+			size_t new_row_count = live_rows;
+
+			for (size_t row : mFreedEntityRows)
+			{
+				if ((row < row_count) && (row_archetypes[row] == kInvalidArchetype) && (new_rows[row] == kInvalidEntityIndex))
+				{
+					new_rows[row] = new_row_count++;
+					moved = moved || (new_rows[row] != row);
+				}
+			}
+
+			mFreedEntityRows.clear();
+			moved = moved || (new_row_count != row_count);
+
+			if (moved)
+			{
+				mEntityScratch.assign(new_row_count, MakeEmptyEntity());
+
+				for (size_t row = 0; row < row_count; row++)
+				{
+					if (new_rows[row] == kInvalidEntityIndex)
+						continue;
+
+					EntityType& entity = mEntityScratch[new_rows[row]];
+					entity = mEntities[row];
+
+					if (entity.Guid != kInvalidEntityGuid)
+					{
+						entity.Index = new_rows[row];
+						mEntitySlots[GetEntityGuidIndex(entity.Guid)].Row = entity.Index;
+					}
+				}
+
+				mEntities.swap(mEntityScratch);
+			}
+
+			const size_t chunk_entities = StoragePolicy::chunk_entities;
+			size_t offsets[sizeof...(ComponentTypes)] = {};
+			row_archetypes.assign(new_row_count, size_t(kInvalidArchetype));
+
+			for (size_t n = 0; n < mArchetypes.size(); n++)
+			{
+				auto& type = mArchetypes[n];
+				std::fill(row_archetypes.begin() + type.FirstRow, row_archetypes.begin() + type.FirstRow + type.RowCount, n);
+
+				for (size_t type_index = 0; type_index < sizeof...(ComponentTypes); type_index++)
+				{
+					type.Offsets[type_index] = offsets[type_index];
+					offsets[type_index] += type.RowCount * type.Counts[type_index];
+				}
+
+				type.FirstChunk = mArchetypeChunks.size();
+
+				for (size_t first = 0; first < type.RowCount; first += chunk_entities)
+					mArchetypeChunks.push_back({ n, type.FirstRow + first, std::min(chunk_entities, type.RowCount - first) });
+
+				type.ChunkCount = mArchetypeChunks.size() - type.FirstChunk;
+			}
+
+			if (moved)
+			{
+				static const typename HousekeepingJob::Callback callbacks[] = { &ClusterComponentType<ComponentTypes>... };
+
+				for (size_t n = 0; n < sizeof...(ComponentTypes); n++)
+				{
+					mComponentJobs[n].Set(this, callbacks[n], 0);
+					mDispatcher.Schedule(&mComponentJobs[n]);
+				}
+
+				mDispatcher.Execute();
+				RemapClusteredRows(mTouchedEntities);
+
+				for (auto& type_touched : mTouchedEntitiesByType)
+					RemapClusteredRows(type_touched);
+
+				for (auto& query : mQueries)
+				{
+					query->Matches.clear();
+					PlanQueryScan(*query);
+				}
+			}
+
+			for (auto& query : mQueries)
+				CollectQueryChunks(*query);
+
+			mArchetypesClustered = true;
+		}
+
+		// Returns the archetype of an entity's component counts, adding it if there's none yet
+		size_t AcquireArchetype(const EntityType& entity)
+		{
+			size_t hash = 0;
+
+			for (unsigned char count : entity.ComponentCount)
+				hash = hash * 31 + count;
+
+			auto range = mArchetypeLookup.equal_range(hash);
+
+			for (auto it = range.first; it != range.second; ++it)
+			{
+				if (memcmp(mArchetypes[it->second].Counts, entity.ComponentCount, sizeof(entity.ComponentCount)) == 0)
+					return it->second;
+			}
+
+			Archetype archetype;
+			archetype.FirstRow = 0;
+			archetype.RowCount = 0;
+			archetype.FirstChunk = 0;
+			archetype.ChunkCount = 0;
+			memcpy(archetype.Counts, entity.ComponentCount, sizeof(archetype.Counts));
+			memset(archetype.Offsets, 0, sizeof(archetype.Offsets));
+			memcpy(archetype.ComponentBits, entity.ComponentBits, sizeof(archetype.ComponentBits));
+
+			mArchetypeLookup.emplace(hash, mArchetypes.size());
+			mArchetypes.push_back(archetype);
+			return mArchetypes.size() - 1;
+		}
+
+		template<typename T>
+		static void ClusterComponentType(BasicWorld* world, size_t)
+		{
+			world->ClusterComponents<T>();
+		}
+
+		// Moves T's components to their owners' new rows (see ClusterArchetypes). An outdated future buffer is used
+		// as scratch space, it's copied over from the present buffer once synced.
+		template<typename T>
+		void ClusterComponents()
+		{
+			auto& container = std::get<Container<T>>(mComponents);
+			bool synced = !component_traits<T>::single_buffered && container.IsFutureSynced();
+			bool moved = false;
+			typename Container<T>::BufferType scratch;
+
+			if (synced && ClusterComponentBuffer(container.FutureBuffer, scratch))
+			{
+				moved = true;
+
+				if (component_traits<T>::sparse_set)
+					RebuildComponentLookup(container.FutureBuffer, container.FutureLookup);
+			}
+
+			if (ClusterComponentBuffer(container.PresentBuffer, (component_traits<T>::single_buffered || synced) ? scratch : container.FutureBuffer))
+			{
+				moved = true;
+
+				if (component_traits<T>::sparse_set)
+					RebuildComponentLookup(container.PresentBuffer, container.PresentLookup);
+			}
+
+			if (moved)
+				container.AllBlocksDirty = true;
+
+			container.ChangedVersions.Permute(mClusteredRows.data(), mClusteredRows.size(), GetWriteVersion());
+			container.AddedVersions.Permute(mClusteredRows.data(), mClusteredRows.size(), GetWriteVersion());
+		}
+
+		// Stable counting sort of a buffer by the archetype of its owners' new rows, free rows last. Archetypes keep
+		// the order of their rows so the buffer stays sorted by owner. Returns false if no owner moved.
+		template<typename BufferType>
+		bool ClusterComponentBuffer(BufferType& buffer, BufferType& scratch) const
+		{
+			using ComponentType = typename BufferType::value_type;
+			const size_t free_rows = mArchetypes.size();
+
+			if (std::none_of(buffer.begin(), buffer.end(), [this](const ComponentType& component) { return mClusteredRows[component.OwnerIndex] != component.OwnerIndex; }))
+				return false;
+
+			auto group_of = [this, free_rows](const ComponentType& component) {
+				size_t archetype = mEntityArchetypes[mClusteredRows[component.OwnerIndex]];
+				return (archetype == kInvalidArchetype) ? free_rows : archetype;
+			};
+
+			std::vector<size_t> offsets(free_rows + 2, 0);
+
+			for (auto& component : buffer)
+				offsets[group_of(component) + 1]++;
+
+			for (size_t n = 1; n < offsets.size(); n++)
+				offsets[n] += offsets[n - 1];
+
+			scratch.resize(buffer.size());
+
+			for (size_t n = 0; n < buffer.size(); n++)
+			{
+				size_t moved = offsets[group_of(buffer[n])]++;
+				CopyComponentRange(scratch, moved, buffer, n, 1);
+				scratch[moved].OwnerIndex = mClusteredRows[buffer[n].OwnerIndex];
+			}
+
+			buffer.swap(scratch);
+			return true;
+		}
+
+		// Replaces rows by their clustered rows, dropped rows are removed
+		void RemapClusteredRows(Vector<size_t>& rows) const
 		{
-			std::sort(mPendingComponentActions.begin(), mPendingComponentActions.end(), [](const ComponentAction& lhs, const ComponentAction& rhs) {
-				return (lhs.index < rhs.index) || ((lhs.index == rhs.index) && (lhs.owner.Index < rhs.owner.Index)) ||
-					((lhs.index == rhs.index) && (lhs.owner.Index == rhs.owner.Index) && (lhs.owner.Guid < rhs.owner.Guid));
-			});
+			size_t kept = 0;
 
-			tuple_for_each(mComponents, AddPendingComponents(this));
-			mPendingComponentActions.clear();
-			memset(mComponentCountDelta, 0, sizeof(mComponentCountDelta));
+			for (size_t row : rows)
+			{
+				if ((row < mClusteredRows.size()) && (mClusteredRows[row] != kInvalidEntityIndex))
+					rows[kept++] = mClusteredRows[row];
+			}
+
+			rows.resize(kept);
 		}
 
-		/// Attempts to find an entity that has the specified GUID in the
-		/// current entities vector by using binary search.
-		inline const EntityType* FindEntityPtr(size_t guid) const
+		// Collects the chunks of the archetypes matching a query
+		void CollectQueryChunks(EntityQuery& query) const
 		{
-			auto ent = FindFirstEntity(guid);
+			query.Chunks.clear();
 
-			if ((ent == mEntitySearchList.end()) || (ent->Guid != guid))
-				return nullptr;
-			else
-				return &mEntities[ent->Index];
+			for (auto& archetype : mArchetypes)
+			{
+				if (MatchesQueryBits(query, archetype.ComponentBits))
+				{
+					for (size_t chunk = archetype.FirstChunk; chunk < archetype.FirstChunk + archetype.ChunkCount; chunk++)
+						query.Chunks.push_back(chunk);
+				}
+			}
 		}
 
-		/// Attempts to find an entity that has the specified GUID in the
-		/// current entities vector by using binary search.
-		inline EntityType* FindEntityPtr(size_t guid)
+		// Whether T's future buffer has the present buffer's layout, which only changes while the pending actions of
+		// a double buffered type are applied
+		template<typename T>
+		inline bool FutureHasPresentLayout() const
 		{
-			auto ent = FindFirstEntity(guid);
-
-			if ((ent == mEntitySearchList.end()) || (ent->Guid != guid))
-				return nullptr;
-			else
-				return &mEntities[ent->Index];
+			return component_traits<T>::single_buffered || !mComponentTypeRestructured[ComponentsTypeTuple::index_of<T>::value];
 		}
 
-		/// Searches for an entity by using binary search to search the current entities vector. 
-		/// If the entity's not found it then attempts to search on the pending additions.
-		const EntityType* FindEntityPtrExt(size_t guid) const
+		// Position of the first component of type T the entity at row has (or would have) in T's present or future
+		// buffer, computed from its archetype. Returns false unless the archetypes describe that buffer's layout.
+		template<typename T>
+		inline bool FindArchetypeComponent(size_t row, bool future, size_t& position) const
 		{
-			if (const EntityType* ret = FindEntityPtr(guid))
-			{
-				return ret;
-			}
-			else
-			{
-				for (auto& entity : mPendingEntityAdditions)
-				{
-					if (entity.Guid == guid)
-						return &entity;
-				}
+			if (!StoragePolicy::clusters_archetypes || !mArchetypesClustered || (future && !FutureHasPresentLayout<T>()) ||
+				(row >= mEntityArchetypes.size()) || (mEntityArchetypes[row] == kInvalidArchetype))
+				return false;
 
-				return nullptr;
-			}
+			const size_t type_index = ComponentsTypeTuple::index_of<T>::value;
+			const Archetype& archetype = mArchetypes[mEntityArchetypes[row]];
+			position = archetype.Offsets[type_index] + (row - archetype.FirstRow) * archetype.Counts[type_index];
+			return true;
 		}
 
-		/// Searches for an entity by using binary search to search the current entities vector. 
-		/// If the entity's not found it then attempts to search on the pending additions.
-		EntityType* FindEntityPtrExt(size_t guid)
+		/// Applies the entity additions and removals recorded in the command buffers. Entities queued while
+		/// processing get their slots first, walking the buffers in schedule order so the resulting guids only
+		/// depend on what the processes requested. Their pending guids map to the final ones until the next call.
+		/// Slots freed by this tick's removals are reused from the next tick on.
+		void ExecuteQueuedEntityActions()
 		{
-			if (EntityType* ret = FindEntityPtr(guid))
-			{
-				return ret;
-			}
-			else
+			mPendingEntityGuids.clear();
+
+			for (auto& buffer : mCommandBuffers)
 			{
-				for (auto& entity : mPendingEntityAdditions)
+				for (auto& add : buffer.EntityAdditions)
 				{
-					if (entity.Guid == guid)
-						return &entity;
+					if (IsPendingEntityGuid(add.Guid))
+					{
+						size_t guid = AllocateEntityGuid();
+						mPendingEntityGuids.push_back({ add.Guid, guid });
+						add.Guid = guid;
+						add.Index = GetEntityRow(guid);
+					}
 				}
-
-				return nullptr;
 			}
-		}
 
-		void ExecuteQueuedEntityActions()
-		{
-			for (auto&& remove : mPendingEntityRemovals)
-			{
-				EntityType* ent = FindEntityPtr(remove.Guid);
+			if (!mPendingEntityGuids.empty())
+				ComponentsTypeTuple::for_each(ResolvePendingOwners(this));
 
-				if (ent)
+			// Entities removed more than once simply won't be found after the first removal
+			for (auto& buffer : mCommandBuffers)
+			{
+				for (auto&& remove : buffer.EntityRemovals)
 				{
-					for (auto it = mEntitySearchList.begin(); it != mEntitySearchList.end(); it++)
+					EntityType* ent = FindEntityPtr(remove.Guid);
+
+					if (ent)
 					{
-						if (it->Guid == remove.Guid)
-						{
-							it = mEntitySearchList.erase(it);
-							if (it == mEntitySearchList.end())
-								break;
-						}
+						tuple_for_each(mComponents, QueueRemoval(this, *ent));
+						FreeEntity(*ent);
 					}
+				}
 
-					tuple_for_each(mComponents, QueueRemoval(this, *ent));
+				buffer.EntityRemovals.clear();
+			}
 
-					memset(ent->ComponentCount, 0, sizeof(ent->ComponentCount));
-					memset(ent->InternalComponentCount, 0, sizeof(ent->InternalComponentCount));
+			for (auto& buffer : mCommandBuffers)
+			{
+				for (auto&& add : buffer.EntityAdditions)
+					PlaceEntity(add);
 
-					AvailableEntities.push_back(*ent);
-					memset(ent, 0, sizeof(EntityType));
-					ent->Guid = kInvalidEntityGuid;
-					ent->Index = kInvalidEntityIndex;
-				}
+				buffer.EntityAdditions.clear();
 			}
+		}
+
+		/// Reserves an entity slot and returns the GUID for the slot's next generation. Previously freed slots
+		/// are handed out from the back of the free list, new slots are appended to the slot table. When archetypes
+		/// are clustered the entity gets an empty row at the end of the entities vector as well, rows freed by
+		/// removals are only dropped when the entities are clustered. Only called while no processes are executing.
+		size_t AllocateEntityGuid()
+		{
+			size_t index;
+			size_t guid;
 
-			for (auto&& add : mPendingEntityAdditions)
+			if (!mFreeEntityIndices.empty())
 			{
-				if (add.Index == kInvalidEntityIndex)
-				{
-					add.Index = mEntities.size();
-					mEntities.push_back(add);
-				}
-				else
-				{
-					mEntities[add.Index] = add;
-				}
+				index = mFreeEntityIndices.back();
+				mFreeEntityIndices.pop_back();
+				guid = MakeEntityGuid(index, ++mEntitySlots[index].Generation & kEntityGenerationMask);
+			}
+			else
+			{
+				index = mEntitySlots.size();
+				mEntitySlots.push_back(EntitySlot{ 0, index });
+				guid = MakeEntityGuid(index, 0);
 			}
 
-			mPendingEntityRemovals.clear();
-			mPendingEntityAdditions.clear();
-			mEntitySearchListValid = false;
+			if (StoragePolicy::clusters_archetypes)
+			{
+				mEntitySlots[index].Row = mEntities.size();
+				mEntities.push_back(MakeEmptyEntity());
+			}
+
+			return guid;
 		}
 
-		auto FindFirstEntity(size_t guid) const -> decltype(mEntitySearchList.begin())
+		/// Returns the index in mEntities of the entity a guid's slot holds (or will hold once it's placed). Pending
+		/// guids have no slot yet.
+		inline size_t GetEntityRow(size_t guid) const
 		{
-			if (!mEntitySearchListValid)
-			{
-				struct EntityGuidSortComparator {
-					bool operator()(const EntityType& lhs, const EntityType& rhs) const
-					{
-						return lhs.Guid < rhs.Guid;
-					}
-				};
+			size_t index = GetEntityGuidIndex(guid);
 
-				mEntitySearchList.resize(mEntities.size());
-				memcpy(mEntitySearchList.data(), mEntities.data(), mEntities.size() * sizeof(EntityType));
-				std::sort(mEntitySearchList.begin(), mEntitySearchList.end(), EntityGuidSortComparator());
-				mEntitySearchList.erase(std::remove_if(mEntitySearchList.begin(), mEntitySearchList.end(), [](const EntityType& ent)
-				{
-					return ent.Guid == kInvalidEntityGuid;
-				}), mEntitySearchList.end());
+			if (!StoragePolicy::clusters_archetypes)
+				return index;
+			else
+				return (index < mEntitySlots.size()) ? mEntitySlots[index].Row : kInvalidEntityIndex;
+		}
 
-				mEntitySearchListValid = true;
-			}
+		EntityType MakeEntity(size_t guid, int userValue) const
+		{
+			EntityType ent;
+			ent.Guid = guid;
+			ent.Index = GetEntityRow(guid);
+			ent.UserValue = userValue;
+			memset(ent.ComponentCount, 0, sizeof(ent.ComponentCount));
+			memset(ent.InternalComponentCount, 0, sizeof(ent.InternalComponentCount));
+			memset(ent.ComponentBits, 0, sizeof(ent.ComponentBits));
+			return ent;
+		}
 
-			std::vector<EntityType>::iterator it;
-			auto first = mEntitySearchList.begin();
-			auto last = mEntitySearchList.end();
-			size_t count, step;
-			count = std::distance(first, last);
+		static EntityType MakeEmptyEntity()
+		{
+			EntityType ent;
+			memset(&ent, 0, sizeof(EntityType));
+			ent.Guid = kInvalidEntityGuid;
+			ent.Index = kInvalidEntityIndex;
+			return ent;
+		}
 
-			while (count > 0)
-			{
-				it = first;
-				step = count / 2;
-				std::advance(it, step);
-				if (it->Guid < guid)
-				{
-					first = ++it;
-					count -= step + 1;
-				}
-				else count = step;
-			}
+		/// Stores an entity in the slot reserved by AllocateEntityGuid, growing the entities vector if needed.
+		EntityType& PlaceEntity(const EntityType& ent)
+		{
+			if (ent.Index >= mEntities.size())
+				mEntities.resize(ent.Index + 1, MakeEmptyEntity());
+
+			mEntities[ent.Index] = ent;
+			mEntityCount++;
+			tuple_for_each(mComponents, ResetComponentVersions(mEntities.size(), ent.Index));
+			TouchEntity(ent.Index);
+			return mEntities[ent.Index];
+		}
 
-			return first;
+		/// Clears an entity's slot and returns it to the free list. The slot's generation is bumped
+		/// when it's reused, which invalidates any outstanding references.
+		void FreeEntity(EntityType& ent)
+		{
+			mFreeEntityIndices.push_back(GetEntityGuidIndex(ent.Guid));
+
+			if (StoragePolicy::clusters_archetypes)
+				mFreedEntityRows.push_back(ent.Index);
+
+			TouchEntity(ent.Index);
+			ent = MakeEmptyEntity();
+			mEntityCount--;
 		}
 
 		template<typename T>
@@ -1530,14 +3775,69 @@ namespace au {
 			return first;
 		}
 
+		/// Returns the first component belonging to an entity in one of a container's buffers (or end() if it has none).
+		/// Component types using sparse sets resolve this through the buffer's lookup, others use a binary search.
+		template<typename ContainerType, typename BufferType>
+		inline auto FindFirstComponent(const ContainerType& container, BufferType& buffer, const EntityType& value) const -> decltype(buffer.begin())
+		{
+			return FindFirstComponentImpl(container, buffer, value, std::integral_constant<bool, component_traits<typename ContainerType::value_type>::sparse_set>());
+		}
+
+		/// Returns the position after the last component belonging to an entity in one of a container's buffers.
+		template<typename ContainerType, typename BufferType>
+		inline auto FindLastComponent(const ContainerType& container, BufferType& buffer, const EntityType& value) const -> decltype(buffer.begin())
+		{
+			return FindLastComponentImpl(container, buffer, value, std::integral_constant<bool, component_traits<typename ContainerType::value_type>::sparse_set>());
+		}
+
+		template<typename ContainerType, typename BufferType>
+		inline auto FindFirstComponentImpl(const ContainerType&, BufferType& buffer, const EntityType& value, std::false_type) const -> decltype(buffer.begin())
+		{
+			return FindFirstComponentBelongingToEntity(buffer, value);
+		}
+
+		template<typename ContainerType, typename BufferType>
+		auto FindFirstComponentImpl(const ContainerType& container, BufferType& buffer, const EntityType& value, std::true_type) const -> decltype(buffer.begin())
+		{
+			const auto& lookup = (&buffer == &container.PresentBuffer) ? container.PresentLookup : container.FutureLookup;
+
+			if (lookup.empty())
+				return FindFirstComponentBelongingToEntity(buffer, value);
+			else if ((value.Index >= lookup.size()) || (lookup[value.Index] == kInvalidComponentSlot))
+				return buffer.end();
+			else
+				return buffer.begin() + lookup[value.Index];
+		}
+
+		template<typename ContainerType, typename BufferType>
+		inline auto FindLastComponentImpl(const ContainerType&, BufferType& buffer, const EntityType& value, std::false_type) const -> decltype(buffer.begin())
+		{
+			return FindLastComponentBelongingToEntity(buffer, value);
+		}
+
+		template<typename ContainerType, typename BufferType>
+		auto FindLastComponentImpl(const ContainerType& container, BufferType& buffer, const EntityType& value, std::true_type) const -> decltype(buffer.begin())
+		{
+			auto it = FindFirstComponentImpl(container, buffer, value, std::true_type());
+
+			// Entities without this component still need their insertion point
+			if (it == buffer.end())
+				return FindLastComponentBelongingToEntity(buffer, value);
+
+			while ((it != buffer.end()) && (it->OwnerIndex == value.Index))
+				++it;
+
+			return it;
+		}
+
 		// Tuple Iteration Functors
 		class QueueRemoval {
 		private:
-			World* mOwner;
+			BasicWorld* mOwner;
 			EntityType mTargetEntity;
 			bool mDestructive;
 		public:
-			QueueRemoval(World* ecs, EntityType entity, bool destructive = true)
+			QueueRemoval(BasicWorld* ecs, EntityType entity, bool destructive = true)
 				: mOwner(ecs), mTargetEntity(entity), mDestructive(destructive)
 			{
 			}
@@ -1548,38 +3848,35 @@ namespace au {
 				using CompTypeD = typename std::decay<T>::type::value_type;
 				auto& srcBuff = v.PresentBuffer;
 
-				auto start = mOwner->FindFirstComponentBelongingToEntity(srcBuff, mTargetEntity);
+				auto start = mOwner->FindFirstComponent(v, srcBuff, mTargetEntity);
 
 				if (start == srcBuff.end())
 				{
 				}
 				else
 				{
-					auto end = mOwner->FindLastComponentBelongingToEntity(srcBuff, mTargetEntity);
+					auto end = mOwner->FindLastComponent(v, srcBuff, mTargetEntity);
 
-					ComponentAction removalAction = {
+					std::get<ComponentActionQueue<CompTypeD>>(mOwner->mPendingComponentActions).Removals.push_back({
 						(size_t) std::distance(srcBuff.begin(), start),
 						(size_t) std::distance(start, end),
-						mTargetEntity,
-						detail::RemovalAction{ CompTypeD::Id() },
+						mTargetEntity.Guid,
+						mTargetEntity.Index,
 						mDestructive,
-					};
-
-					mOwner->mComponentCountDelta[ComponentsTypeTuple::index_of<CompTypeD>::value] -= removalAction.removeLength;
-					mOwner->mPendingComponentActions.push_back(removalAction);
+					});
 				}
 			}
 		};
 
 		class ComponentMigrator {
 		private:
-			World* mSource;
-			World* mDestination;
+			BasicWorld* mSource;
+			BasicWorld* mDestination;
 			EntityType mSourceEntity;
 			EntityRef mDestinationEntity;
 			std::vector<EntityRef>* mInheritedMigrations;
 		public:
-			ComponentMigrator(World* source, World* destination, EntityType source_entity, EntityType destination_entity, std::vector<EntityRef>* inherit_migrations)
+			ComponentMigrator(BasicWorld* source, BasicWorld* destination, EntityType source_entity, EntityType destination_entity, std::vector<EntityRef>* inherit_migrations)
 				: mSource(source), mDestination(destination), mSourceEntity(source_entity), mInheritedMigrations(inherit_migrations)
 			{
 				mDestinationEntity = EntityRef{ destination_entity.Guid, destination_entity.Index, destination, destination_entity.UserValue };
@@ -1593,7 +3890,7 @@ namespace au {
 			}
 
 			template<typename T>
-			inline typename std::enable_if<T::HasCustomMigrationHandling == false>::type TriggerOnMigrate(T* component)
+			inline typename std::enable_if<T::HasCustomMigrationHandling == false>::type TriggerOnMigrate(T*)
 			{
 			}
 
@@ -1602,18 +3899,18 @@ namespace au {
 			{
 				using CompTypeD = typename std::decay<T>::type::value_type;
 				auto& source_buffer = v.PresentBuffer;
-				auto& destination_buffer = std::get<ComponentContainer<CompTypeD>>(mDestination->mComponents).PresentBuffer;
+				auto& destination_buffer = std::get<Container<CompTypeD>>(mDestination->mComponents).PresentBuffer;
 
-				auto start = mSource->FindFirstComponentBelongingToEntity(source_buffer, mSourceEntity);
+				auto start = mSource->FindFirstComponent(v, source_buffer, mSourceEntity);
 
 				if (start != source_buffer.end())
 				{
-					auto end = mSource->FindLastComponentBelongingToEntity(source_buffer, mSourceEntity);
+					auto end = mSource->FindLastComponent(v, source_buffer, mSourceEntity);
 
 					for (auto it = start; it != end; it++)
 					{
 						TriggerOnMigrate<CompTypeD>(&(*it));
-						if (!mDestination->AddComponent(mDestinationEntity, *it))
+						if (!mDestination->AddComponent(mDestinationEntity, LoadComponentAt(source_buffer, std::distance(source_buffer.begin(), it))))
 							throw ComponentMigrationFailureException(CompTypeD::Id(), mSourceEntity.Guid);
 					}
 				}
@@ -1622,10 +3919,10 @@ namespace au {
 		
 		class ComponentMigrationNotifier {
 		private:
-			World* mWorld;
+			BasicWorld* mWorld;
 			EntityType* mEntity;
 		public:
-			ComponentMigrationNotifier(World* world, EntityType* entity)
+			ComponentMigrationNotifier(BasicWorld* world, EntityType* entity)
 				: mWorld(world), mEntity(entity)
 			{
 			}
@@ -1638,7 +3935,7 @@ namespace au {
 			}
 
 			template<typename T>
-			inline typename std::enable_if<T::HasCustomMigrationHandling == false>::type TriggerOnMigrateComplete(T* component)
+			inline typename std::enable_if<T::HasCustomMigrationHandling == false>::type TriggerOnMigrateComplete(T*)
 			{
 			}
 
@@ -1647,11 +3944,11 @@ namespace au {
 			{
 				using CompTypeD = typename std::decay<T>::type::value_type;
 				auto& source_buffer = v.PresentBuffer;
-				auto start = mWorld->FindFirstComponentBelongingToEntity(source_buffer, *mEntity);
+				auto start = mWorld->FindFirstComponent(v, source_buffer, *mEntity);
 
 				if (start != source_buffer.end())
 				{
-					auto end = mWorld->FindLastComponentBelongingToEntity(source_buffer, *mEntity);
+					auto end = mWorld->FindLastComponent(v, source_buffer, *mEntity);
 
 					for (auto it = start; it != end; it++)
 						TriggerOnMigrateComplete<CompTypeD>(&(*it));
@@ -1663,15 +3960,21 @@ namespace au {
 			template<typename T>
 			inline void operator()(T&& v)
 			{
-				std::swap(v.PresentBuffer, v.FutureBuffer);
+				if (v.IsFutureSynced())
+				{
+					std::swap(v.PresentBuffer, v.FutureBuffer);
+					std::swap(v.PresentLookup, v.FutureLookup);
+				}
+
+				v.FutureState.store(FutureBufferState::Outdated, std::memory_order_relaxed);
 			}
 		};
 
 		class AddPendingComponents {
 		private:
-			World* mOwner;
+			BasicWorld* mOwner;
 		public:
-			AddPendingComponents(World* owner) : mOwner(owner)
+			AddPendingComponents(BasicWorld* owner) : mOwner(owner)
 			{
 			}
 
@@ -1680,118 +3983,223 @@ namespace au {
 			{
 				using CompTypeD = typename std::decay<T>::type::value_type;
 				auto start_time = std::chrono::high_resolution_clock::now();
-				auto& srcBuff = v.PresentBuffer;
-				auto& targetBuff = v.FutureBuffer;
 				auto& compMetrics = mOwner->mMetrics.ComponentMetrics[ComponentsTypeTuple::index_of<CompTypeD>::value];
 				compMetrics.TypeId = CompTypeD::Id();
 
+				auto& actions = mOwner->template CollectPendingComponentActions<CompTypeD>();
+				mOwner->mComponentTypeRestructured[ComponentsTypeTuple::index_of<CompTypeD>::value] = !actions.Additions.empty() || !actions.Removals.empty();
+
+				// Untouched types are only synced once a process requests authority over them
+				if (!actions.Additions.empty() || !actions.Removals.empty())
+				{
+					Apply(v, actions, compMetrics, std::integral_constant<bool, component_traits<CompTypeD>::single_buffered>());
+					actions.Additions.clear();
+					actions.Removals.clear();
+				}
+
+				std::chrono::duration<double> delta = std::chrono::high_resolution_clock::now() - start_time;
+				compMetrics.UpdateTime = delta.count();
+			}
+		private:
+			// Whether the next action to apply is a removal. Additions come first when both target the same slot.
+			template<typename CompTypeD>
+			static inline bool NextIsRemoval(const ComponentActionQueue<CompTypeD>& actions, size_t addition, size_t removal)
+			{
+				return (removal < actions.Removals.size()) && ((addition == actions.Additions.size()) ||
+					detail::ComponentActionPrecedes(actions.Removals[removal], actions.Additions[addition]));
+			}
+
+			// Rebuilds the future buffer from the present buffer and the pending actions
+			template<typename CompTypeD>
+			void Apply(Container<CompTypeD>& v, ComponentActionQueue<CompTypeD>& actions, WorldMetricsBase::ComponentMetrics_t& compMetrics, std::false_type)
+			{
+				const size_t type_index = ComponentsTypeTuple::index_of<CompTypeD>::value;
+				auto& touched = mOwner->mTouchedEntitiesByType[type_index];
+				auto& srcBuff = v.PresentBuffer;
+				auto& targetBuff = v.FutureBuffer;
+				unsigned version = mOwner->GetWriteVersion();
+				size_t removed = 0;
+
+				for (auto& removal : actions.Removals)
+					removed += removal.Length;
+
 				targetBuff.clear();
-				targetBuff.resize(srcBuff.size() + mOwner->mComponentCountDelta[ComponentsTypeTuple::index_of<CompTypeD>::value]);
+				targetBuff.resize(srcBuff.size() + actions.Additions.size() - removed);
 				size_t copyOrigStart = 0;
 				size_t copyDestStart = 0;
+				size_t addition = 0;
+				size_t removal = 0;
 
-				for (auto& action : mOwner->mPendingComponentActions)
+				while ((addition < actions.Additions.size()) || (removal < actions.Removals.size()))
 				{
-					if (action.data.which() == sizeof...(ComponentTypes))
+					if (NextIsRemoval(actions, addition, removal))
 					{
-						if (action.data.get<detail::RemovalAction>().id == CompTypeD::Id())
+						auto& action = actions.Removals[removal++];
+
+						if (action.Destructive)
+							DestroyComponentRange(srcBuff.data() + action.Index, action.Length);
+
+						size_t toCopy = action.Index - copyOrigStart;
+
+						if (toCopy > 0)
 						{
-							if (action.destructive)
-							{
-								for (size_t n = 0; n < action.removeLength; n++)
-									srcBuff[action.index + n].Destroy();
-							}
-
-							size_t toCopy = action.index - copyOrigStart;
-
-							if (toCopy > 0)
-							{
-								memcpy(&targetBuff.data()[copyDestStart], &srcBuff.data()[copyOrigStart], sizeof(CompTypeD) * toCopy);
-								copyOrigStart += toCopy;
-								copyDestStart += toCopy;
-							}
-
-							EntityType* owner = mOwner->FindEntityPtrExt(action.owner.Guid);
-							if (owner)
-								owner->InternalComponentCount[ComponentsTypeTuple::index_of<CompTypeD>::value] -= (unsigned char) action.removeLength;
-
-							copyOrigStart += action.removeLength;
-							compMetrics.DeleteOps++;
+							CopyComponentRange(targetBuff, copyDestStart, srcBuff, copyOrigStart, toCopy);
+							copyOrigStart += toCopy;
+							copyDestStart += toCopy;
 						}
-						continue;
-					}
 
-					if (action.data.which() != ComponentsTypeTuple::index_of<CompTypeD>::value)
-						continue;
+						EntityType* owner = mOwner->FindEntityPtr(action.OwnerGuid);
+						if (owner)
+						{
+							owner->InternalComponentCount[type_index] -= (unsigned char) action.Length;
+							touched.push_back(owner->Index);
+						}
 
-					EntityType* owner = mOwner->FindEntityPtrExt(action.owner.Guid);
-					if (owner)
+						copyOrigStart += action.Length;
+						compMetrics.DeleteOps++;
+					}
+					else
 					{
-						if ((action.index - copyOrigStart) > 0)
-						{
-							size_t toCopy = action.index - copyOrigStart;
-							memcpy(&targetBuff.data()[copyDestStart], &srcBuff.data()[copyOrigStart], sizeof(CompTypeD) * toCopy);
-							try
-							{
-								auto& dst = targetBuff[copyDestStart + toCopy];
-								dst = action.data.get<CompTypeD>();
-								dst.OwnerIndex = owner->Index;
-								owner->InternalComponentCount[ComponentsTypeTuple::index_of<CompTypeD>::value]++;
-								copyDestStart++;
-							}
-							catch (const std::exception& ex)
-							{
-								printf(ex.what());
-							}
+						auto& action = actions.Additions[addition++];
+						EntityType* owner = mOwner->FindEntityPtr(action.OwnerGuid);
+						if (!owner)
+							continue;
+
+						size_t toCopy = action.Index - copyOrigStart;
 
+						if (toCopy > 0)
+						{
+							CopyComponentRange(targetBuff, copyDestStart, srcBuff, copyOrigStart, toCopy);
 							copyOrigStart += toCopy;
 							copyDestStart += toCopy;
-							compMetrics.AddOps++;
 						}
-						else
+
+						StoreComponentAt(targetBuff, copyDestStart, action.Data);
+						targetBuff[copyDestStart++].OwnerIndex = owner->Index;
+						owner->InternalComponentCount[type_index]++;
+						v.AddedVersions.Mark(owner->Index, version);
+						v.ChangedVersions.Mark(owner->Index, version);
+						touched.push_back(owner->Index);
+						compMetrics.AddOps++;
+					}
+				}
+
+				if (copyOrigStart < srcBuff.size())
+					CopyComponentRange(targetBuff, copyDestStart, srcBuff, copyOrigStart, srcBuff.size() - copyOrigStart);
+
+				if (component_traits<CompTypeD>::sparse_set)
+				{
+					RebuildComponentLookup(targetBuff, v.FutureLookup);
+
+					if (v.PresentLookup.empty())
+						RebuildComponentLookup(srcBuff, v.PresentLookup);
+				}
+
+				v.ResetDirtyBlocks(true);
+				v.FutureState.store(FutureBufferState::Synced, std::memory_order_release);
+			}
+
+			// Applies the pending actions to a single buffered type's present buffer in place. Removed ranges are
+			// compacted out in a forward pass, then the new components are merged in from the back so no second
+			// buffer is ever needed. Present counts are updated along with the internal ones since both refer to
+			// the same buffer, presence bits are left to UpdateSingleBufferedComponentBits.
+			template<typename CompTypeD>
+			void Apply(Container<CompTypeD>& v, ComponentActionQueue<CompTypeD>& actions, WorldMetricsBase::ComponentMetrics_t& compMetrics, std::true_type)
+			{
+				using Addition = typename ComponentActionQueue<CompTypeD>::Addition;
+				const size_t type_index = ComponentsTypeTuple::index_of<CompTypeD>::value;
+				auto& touched = mOwner->mTouchedEntitiesByType[type_index];
+				auto& buffer = v.PresentBuffer;
+				std::vector<std::pair<size_t, const Addition*>> additions;
+
+				// The new components are visible right away rather than from the next tick on
+				unsigned version = mOwner->mTickVersion - 1;
+				size_t read = 0;
+				size_t write = 0;
+				size_t addition = 0;
+				size_t removal = 0;
+
+				while ((addition < actions.Additions.size()) || (removal < actions.Removals.size()))
+				{
+					if (NextIsRemoval(actions, addition, removal))
+					{
+						auto& action = actions.Removals[removal++];
+
+						if (action.Destructive)
+							DestroyComponentRange(buffer.data() + action.Index, action.Length);
+
+						if (write != read)
+							CopyComponentRange(buffer, write, buffer, read, action.Index - read);
+
+						write += action.Index - read;
+						read = action.Index + action.Length;
+
+						EntityType* owner = mOwner->FindEntityPtr(action.OwnerGuid);
+						if (owner)
 						{
-							try
-							{
-								auto& dst = targetBuff[copyDestStart];
-								dst = action.data.get<CompTypeD>();
-								dst.OwnerIndex = owner->Index;
-
-								owner->InternalComponentCount[ComponentsTypeTuple::index_of<CompTypeD>::value]++;
-								copyDestStart++;
-							}
-							catch (const std::exception& ex)
-							{
-								printf(ex.what());
-							}
-
-							compMetrics.AddOps++;
+							owner->InternalComponentCount[type_index] -= (unsigned char) action.Length;
+							owner->ComponentCount[type_index] -= (unsigned char) action.Length;
+							touched.push_back(owner->Index);
 						}
+
+						compMetrics.DeleteOps++;
+					}
+					else
+					{
+						auto& action = actions.Additions[addition++];
+
+						// Position within the compacted buffer
+						if (mOwner->FindEntityPtr(action.OwnerGuid))
+							additions.emplace_back(write + (action.Index - read), &action);
 					}
 				}
 
-				if (copyOrigStart < srcBuff.size())
-					memcpy(&targetBuff.data()[copyDestStart], &srcBuff.data()[copyOrigStart], sizeof(CompTypeD) * (srcBuff.size() - copyOrigStart));
+				if (write != read)
+					CopyComponentRange(buffer, write, buffer, read, buffer.size() - read);
 
-				std::chrono::duration<double> delta = std::chrono::high_resolution_clock::now() - start_time;
-				compMetrics.UpdateTime = delta.count();
+				size_t src = write + (buffer.size() - read);
+				size_t dst = src + additions.size();
+
+				buffer.resize(dst);
+
+				for (size_t n = additions.size(); n-- > 0;)
+				{
+					while (src > additions[n].first)
+						CopyComponentRange(buffer, --dst, buffer, --src, 1);
+
+					const Addition& action = *additions[n].second;
+					EntityType* owner = mOwner->FindEntityPtr(action.OwnerGuid);
+
+					StoreComponentAt(buffer, --dst, action.Data);
+					buffer[dst].OwnerIndex = owner->Index;
+					owner->InternalComponentCount[type_index]++;
+					owner->ComponentCount[type_index]++;
+					v.AddedVersions.Mark(owner->Index, version);
+					v.ChangedVersions.Mark(owner->Index, version);
+					touched.push_back(owner->Index);
+					compMetrics.AddOps++;
+				}
+
+				if (component_traits<CompTypeD>::sparse_set)
+					RebuildComponentLookup(buffer, v.PresentLookup);
 			}
 		};
 
 		class RequestAuthority {
 		private:
-			World* mOwner;
+			BasicWorld* mOwner;
 			void* mAuthoritySource;
 		public:
-			RequestAuthority(World* owner) : mOwner(owner), mAuthoritySource(nullptr)
+			RequestAuthority(BasicWorld* owner) : mOwner(owner), mAuthoritySource(nullptr)
 			{
 			}
 
-			RequestAuthority(World* owner, void* authoritySource) : mOwner(owner), mAuthoritySource(authoritySource)
+			RequestAuthority(BasicWorld* owner, void* authoritySource) : mOwner(owner), mAuthoritySource(authoritySource)
 			{
 			}
 
 			template<typename T>
-			void operator()(T* v, std::size_t type_index)
+			void operator()(T*, std::size_t)
 			{
 				auto& authdata = mOwner->mAuthorityExists[type_tuple<ComponentTypes...>::index_of<T>::value];
 
@@ -1804,22 +4212,126 @@ namespace au {
 					authdata.Requested = true;
 					authdata.RequestSource = mAuthoritySource;
 				}
+
+				std::get<Container<T>>(mOwner->mComponents).SyncFutureBuffer();
+			}
+		};
+
+		// Builds the signature of a selection, filters select their component and Without<> entries exclude theirs
+		struct ComponentMaskBuilder {
+			ComponentMask Mask;
+			ComponentMask Excluded;
+
+			template<typename T>
+			inline void operator()(T*, std::size_t)
+			{
+				Mask.set(ComponentsTypeTuple::index_of<T>::value);
+			}
+
+			template<typename T>
+			inline void operator()(Changed<T>*, std::size_t)
+			{
+				Mask.set(ComponentsTypeTuple::index_of<T>::value);
+			}
+
+			template<typename T>
+			inline void operator()(Added<T>*, std::size_t)
+			{
+				Mask.set(ComponentsTypeTuple::index_of<T>::value);
+			}
+
+			template<typename... T>
+			inline void operator()(Without<T...>*, std::size_t)
+			{
+				ComponentMaskBuilder excluded;
+				type_tuple<T...>::for_each(excluded);
+				Excluded |= excluded.Mask;
+			}
+		};
+
+		struct ResetComponentVersions {
+			size_t EntityCount;
+			size_t Index;
+
+			ResetComponentVersions(size_t entityCount, size_t index) : EntityCount(entityCount), Index(index)
+			{
+			}
+
+			template<typename T>
+			inline void operator()(T&& v)
+			{
+				v.ChangedVersions.Reserve(EntityCount);
+				v.AddedVersions.Reserve(EntityCount);
+				v.ChangedVersions.Reset(Index);
+				v.AddedVersions.Reset(Index);
+			}
+		};
+
+		// Gives the components queued for pending entities their final owner and position in the present buffer
+		class ResolvePendingOwners {
+		private:
+			BasicWorld* mOwner;
+		public:
+			ResolvePendingOwners(BasicWorld* owner) : mOwner(owner)
+			{
+			}
+
+			template<typename T>
+			void operator()(T*, std::size_t)
+			{
+				auto& container = std::get<Container<T>>(mOwner->mComponents);
+
+				for (auto& buffer : mOwner->mCommandBuffers)
+				{
+					for (auto& addition : std::get<ComponentActionQueue<T>>(buffer.ComponentActions).Additions)
+					{
+						if (!IsPendingEntityGuid(addition.OwnerGuid))
+							continue;
+
+						size_t guid = mOwner->ResolvePendingEntityGuid(addition.OwnerGuid);
+
+						// Entities that weren't added this tick have no final guid, the addition is dropped like any other orphan
+						if (guid == kInvalidEntityGuid)
+							continue;
+
+						EntityType owner = mOwner->MakeEntity(guid, 0);
+						addition.Index = std::distance(container.PresentBuffer.begin(), mOwner->FindLastComponent(container, container.PresentBuffer, owner));
+						addition.OwnerGuid = owner.Guid;
+						addition.OwnerIndex = owner.Index;
+						addition.Data.OwnerIndex = owner.Index;
+					}
+				}
+			}
+		};
+
+		class SyncFutureBuffers {
+		private:
+			BasicWorld* mOwner;
+		public:
+			SyncFutureBuffers(BasicWorld* owner) : mOwner(owner)
+			{
+			}
+
+			template<typename T>
+			inline void operator()(T*, std::size_t)
+			{
+				std::get<Container<T>>(mOwner->mComponents).SyncFutureBuffer();
 			}
 		};
 
 		class RequestMultiAuthority {
 		private:
-			World* mOwner;
+			BasicWorld* mOwner;
 			std::initializer_list<void*> mAuthoritySource;
 			unsigned int mAuthoritySourceIndex;
 		public:
-			RequestMultiAuthority(World* owner, std::initializer_list<void*> authoritySource) 
+			RequestMultiAuthority(BasicWorld* owner, std::initializer_list<void*> authoritySource) 
 				: mOwner(owner), mAuthoritySource(authoritySource), mAuthoritySourceIndex(0)
 			{
 			}
 
 			template<typename T>
-			void operator()(T* v, std::size_t type_index)
+			void operator()(T*, std::size_t)
 			{
 				auto& authdata = mOwner->mAuthorityExists[type_tuple<ComponentTypes...>::index_of<T>::value];
 
@@ -1839,6 +4351,8 @@ namespace au {
 					authdata.RequestSource = auth_source;
 				}
 
+				std::get<Container<T>>(mOwner->mComponents).SyncFutureBuffer();
+
 				mAuthoritySourceIndex++;
 			}
 		};
@@ -1847,9 +4361,14 @@ namespace au {
 			template<typename T>
 			inline void operator()(T&& v)
 			{
-				for (auto& comp : v.PresentBuffer)
-					comp.Destroy();
+				DestroyComponentRange(v.PresentBuffer.data(), v.PresentBuffer.size());
 			}
 		};
 	};
+
+	template<typename DispatcherType, typename... ComponentTypes>
+	using World = BasicWorld<std::allocator, DispatcherType, ContainerStorage, ComponentTypes...>;
+
+	template<typename DispatcherType, typename... ComponentTypes>
+	using ArchetypeWorld = BasicWorld<std::allocator, DispatcherType, ArchetypeStorage<>, ComponentTypes...>;
 }
\ No newline at end of file
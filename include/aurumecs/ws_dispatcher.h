@@ -0,0 +1,389 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "iprocess.h"
+#include "sync.h"
+
+namespace au {
+	namespace detail {
+		static const size_t kCacheLineSize = 64;
+
+		// Chase-Lev deque of pointers. Only the owning thread may push and pop, which happens at the bottom, while
+		// any thread may steal from the top. The ring grows as needed, rings that were replaced are kept alive until
+		// the deque is destroyed since thieves may still be reading them.
+		template<typename T>
+		class WorkStealingDeque {
+			struct Ring {
+				std::int64_t Mask;
+				std::unique_ptr<std::atomic<T*>[]> Slots;
+
+				explicit Ring(std::int64_t capacity) : Mask(capacity - 1), Slots(new std::atomic<T*>[(size_t) capacity])
+				{
+				}
+
+				inline T* Get(std::int64_t index) const
+				{
+					return Slots[(size_t) (index & Mask)].load(std::memory_order_relaxed);
+				}
+
+				inline void Put(std::int64_t index, T* value)
+				{
+					Slots[(size_t) (index & Mask)].store(value, std::memory_order_relaxed);
+				}
+			};
+
+			// Thieves hammer on the top while the owner works on the bottom, so they get their own cache lines
+			alignas(kCacheLineSize) std::atomic<std::int64_t> mTop{ 0 };
+			alignas(kCacheLineSize) std::atomic<std::int64_t> mBottom{ 0 };
+			std::atomic<Ring*> mRing{ nullptr };
+			std::vector<std::unique_ptr<Ring>> mRings;
+		public:
+			explicit WorkStealingDeque(std::int64_t capacity = 64)
+			{
+				mRings.emplace_back(new Ring(capacity));
+				mRing = mRings.back().get();
+			}
+
+			WorkStealingDeque(const WorkStealingDeque&) = delete;
+			WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+			// Owner only
+			void Push(T* value)
+			{
+				std::int64_t bottom = mBottom.load(std::memory_order_relaxed);
+				std::int64_t top = mTop.load(std::memory_order_acquire);
+				Ring* ring = mRing.load(std::memory_order_relaxed);
+
+				if (bottom - top > ring->Mask)
+					ring = Grow(ring, top, bottom);
+
+				ring->Put(bottom, value);
+				mBottom.store(bottom + 1, std::memory_order_release);
+			}
+
+			// Owner only, returns the most recently pushed value or nullptr if empty
+			T* Pop()
+			{
+				std::int64_t bottom = mBottom.load(std::memory_order_relaxed) - 1;
+				Ring* ring = mRing.load(std::memory_order_relaxed);
+
+				// Claiming the bottom slot must be visible before reading the top, thieves do the opposite
+				mBottom.store(bottom, std::memory_order_seq_cst);
+				std::int64_t top = mTop.load(std::memory_order_seq_cst);
+
+				if (top > bottom)
+				{
+					mBottom.store(bottom + 1, std::memory_order_relaxed);
+					return nullptr;
+				}
+
+				T* value = ring->Get(bottom);
+
+				// Racing thieves for the last value
+				if (top == bottom)
+				{
+					if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+						value = nullptr;
+
+					mBottom.store(bottom + 1, std::memory_order_relaxed);
+				}
+
+				return value;
+			}
+
+			// Any thread, returns the least recently pushed value or nullptr if empty or lost to another thread
+			T* Steal()
+			{
+				std::int64_t top = mTop.load(std::memory_order_seq_cst);
+				std::int64_t bottom = mBottom.load(std::memory_order_seq_cst);
+
+				if (top >= bottom)
+					return nullptr;
+
+				T* value = mRing.load(std::memory_order_acquire)->Get(top);
+
+				if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					return nullptr;
+
+				return value;
+			}
+		private:
+			Ring* Grow(Ring* ring, std::int64_t top, std::int64_t bottom)
+			{
+				std::unique_ptr<Ring> grown(new Ring((ring->Mask + 1) * 2));
+
+				for (std::int64_t n = top; n < bottom; n++)
+					grown->Put(n, ring->Get(n));
+
+				mRings.push_back(std::move(grown));
+				mRing.store(mRings.back().get(), std::memory_order_release);
+				return mRings.back().get();
+			}
+		};
+	}
+
+	// A dispatcher that executes processes over (NumThreads + 1) threads, like MultiThreadedDispatcher, but
+	// balances the load through work stealing. Every thread owns a deque of tasks, it works on the tasks it pushed
+	// last and steals the oldest tasks of a random victim when it runs out. Execute() pushes the scheduled
+	// processes to the calling thread's deque, where every thread takes them in scheduling order, and
+	// ParallelFor() pushes helper tasks to the caller's deque, so chunked loops are spread the same way and threads
+	// waiting on them keep working on whatever is left.
+	template<int NumThreads>
+	class WorkStealingDispatcher {
+		static_assert(NumThreads > 0, "Must use more at least two threads (including the spawning thread) for a WorkStealingDispatcher");
+		static_assert(NumThreads < 32, "Probably a bad idea to use more than 32 threads in a WorkStealingDispatcher");
+	private:
+		// Task records are padded to a cache line so threads running neighbouring tasks don't share lines
+		struct alignas(detail::kCacheLineSize) Task {
+			void(*Run)(WorkStealingDispatcher& owner, Task& task) = nullptr;
+			void* Context = nullptr;
+		};
+
+		// Chunked loop started by ParallelFor(), lives on the caller's stack until every helper task is done
+		struct ParallelJob {
+			void(*Callback)(void*, size_t) = nullptr;
+			void* Context = nullptr;
+			size_t ChunkCount = 0;
+			alignas(detail::kCacheLineSize) std::atomic<size_t> NextChunk{ 0 };
+			alignas(detail::kCacheLineSize) std::atomic<int> PendingTasks{ 0 };
+		};
+
+		double mTimeSec = 0.0;
+		detail::WorkStealingDeque<Task> mDeques[NumThreads + 1];
+		std::thread mThreads[NumThreads];
+		std::vector<Task> mProcessTasks;
+		std::atomic<size_t> mPendingProcesses{ 0 };
+		std::atomic_bool mExecuting{ false };
+		std::atomic<int> mActiveWorkers{ 0 };
+		detail::BatchSignal mBatchSignal;
+
+		// Dispatcher the calling thread belongs to and its index there, threads that don't belong to any use 0
+		struct ThreadIdentity {
+			const WorkStealingDispatcher* Owner = nullptr;
+			int Index = 0;
+		};
+
+		static inline ThreadIdentity& GetThreadIdentity()
+		{
+			static thread_local ThreadIdentity identity;
+			return identity;
+		}
+
+		static thread_local std::uint32_t sRandomState;
+	public:
+		// How long workers keep spinning for a new batch before parking
+		static constexpr std::chrono::microseconds SpinDuration()
+		{
+			return std::chrono::microseconds(200);
+		}
+
+		WorkStealingDispatcher()
+		{
+			mProcessTasks.reserve(10);
+
+			for (int n = 0; n < NumThreads; n++)
+				mThreads[n] = std::thread(ThreadExecutionCallback, this, n);
+		}
+
+		~WorkStealingDispatcher()
+		{
+			mBatchSignal.Stop();
+
+			for (int n = 0; n < NumThreads; n++)
+				mThreads[n].join();
+		}
+
+		WorkStealingDispatcher(const WorkStealingDispatcher&) = delete;
+		WorkStealingDispatcher(WorkStealingDispatcher&&) = delete;
+		WorkStealingDispatcher& operator=(const WorkStealingDispatcher&) = delete;
+
+		inline void Schedule(IProcess* process)
+		{
+			Task task;
+			task.Run = &RunProcessTask;
+			task.Context = process;
+			mProcessTasks.push_back(task);
+		}
+
+		void Execute()
+		{
+			if (mProcessTasks.empty())
+				return;
+
+			mPendingProcesses = mProcessTasks.size();
+
+			// This thread takes processes from the top of its deque like thieves do, so every thread picks them up
+			// in scheduling order
+			for (Task& task : mProcessTasks)
+				mDeques[0].Push(&task);
+
+			mExecuting = true;
+			mBatchSignal.Publish();
+
+			detail::Backoff backoff;
+
+			while (mPendingProcesses.load(std::memory_order_acquire) != 0)
+			{
+				if (RunNextTask(0, true))
+					backoff.Reset();
+				else
+					backoff.Pause();
+			}
+
+			// Workers check mExecuting after registering as active, so none of them can start looking for tasks
+			// once this sees no active workers
+			mExecuting = false;
+			backoff.Reset();
+
+			while (mActiveWorkers != 0)
+				backoff.Pause();
+
+			mProcessTasks.clear();
+		}
+
+		/// Calls callback(context, chunk) for every chunk < chunk_count. Helper tasks are pushed to the calling
+		/// thread's deque for idle threads to steal, and the caller keeps running tasks until the loop is done.
+		/// Meant to be called from inside processes, the callback must not throw nor call ParallelFor itself.
+		void ParallelFor(size_t chunk_count, void(*callback)(void*, size_t), void* context)
+		{
+			if (chunk_count == 0)
+				return;
+
+			int index = GetCurrentThreadIndex();
+			ParallelJob job;
+			Task helpers[NumThreads];
+			int helper_count = (chunk_count > (size_t) NumThreads) ? NumThreads : (int) chunk_count - 1;
+
+			job.Callback = callback;
+			job.Context = context;
+			job.ChunkCount = chunk_count;
+			job.PendingTasks = helper_count;
+
+			for (int n = 0; n < helper_count; n++)
+			{
+				helpers[n].Run = &RunParallelTask;
+				helpers[n].Context = &job;
+				mDeques[index].Push(&helpers[n]);
+			}
+
+			RunParallelChunks(job);
+
+			// Helpers nobody stole are popped back and find no chunks left, the job must outlive all of them
+			detail::Backoff backoff;
+
+			while (job.PendingTasks.load(std::memory_order_acquire) != 0)
+			{
+				if (RunNextTask(index))
+					backoff.Reset();
+				else
+					backoff.Pause();
+			}
+		}
+
+		inline void SetTime(double timeSec)
+		{
+			mTimeSec = timeSec;
+		}
+
+		inline int GetThreadCount() const
+		{
+			return NumThreads + 1;
+		}
+
+		// Returns the index of the dispatcher thread the caller is running on, the thread
+		// that calls Execute() is always index 0 and worker threads use 1 to NumThreads.
+		// NOTE: Only meaningful when called from this dispatcher's threads.
+		inline int GetCurrentThreadIndex() const
+		{
+			const ThreadIdentity& identity = GetThreadIdentity();
+			return (identity.Owner == this) ? identity.Index : 0;
+		}
+	private:
+		static void RunProcessTask(WorkStealingDispatcher& owner, Task& task)
+		{
+			static_cast<IProcess*>(task.Context)->Execute(owner.mTimeSec);
+			owner.mPendingProcesses.fetch_sub(1, std::memory_order_release);
+		}
+
+		static void RunParallelTask(WorkStealingDispatcher&, Task& task)
+		{
+			ParallelJob& job = *static_cast<ParallelJob*>(task.Context);
+
+			RunParallelChunks(job);
+			job.PendingTasks.fetch_sub(1, std::memory_order_release);
+		}
+
+		static void RunParallelChunks(ParallelJob& job)
+		{
+			size_t chunk;
+
+			while ((chunk = job.NextChunk.fetch_add(1, std::memory_order_relaxed)) < job.ChunkCount)
+				job.Callback(job.Context, chunk);
+		}
+
+		// Runs a task from the thread's own deque, its oldest one when fifo is set and its newest one otherwise, or
+		// one stolen from another thread when empty. Returns whether a task was run.
+		bool RunNextTask(int index, bool fifo = false)
+		{
+			Task* task = fifo ? mDeques[index].Steal() : mDeques[index].Pop();
+
+			if (!task)
+			{
+				// xorshift32, victims only need to be spread out
+				sRandomState ^= sRandomState << 13;
+				sRandomState ^= sRandomState >> 17;
+				sRandomState ^= sRandomState << 5;
+
+				int first = (int) (sRandomState % (NumThreads + 1));
+
+				for (int n = 0; (n <= NumThreads) && !task; n++)
+				{
+					int victim = (first + n) % (NumThreads + 1);
+
+					if (victim != index)
+						task = mDeques[victim].Steal();
+				}
+
+				if (!task)
+					return false;
+			}
+
+			task->Run(*this, *task);
+			return true;
+		}
+
+		static void ThreadExecutionCallback(WorkStealingDispatcher<NumThreads>* owner, int tindex)
+		{
+			GetThreadIdentity().Owner = owner;
+			GetThreadIdentity().Index = tindex + 1;
+			sRandomState = 0x9E3779B9u * (std::uint32_t) (tindex + 1);
+			unsigned batch = 0;
+
+			while (owner->mBatchSignal.Wait(batch, SpinDuration()))
+			{
+				owner->mActiveWorkers++;
+
+				// Steal until the batch is over, tasks of parallel loops keep showing up until then
+				detail::Backoff backoff;
+
+				while (owner->mExecuting)
+				{
+					if (owner->RunNextTask(tindex + 1))
+						backoff.Reset();
+					else
+						backoff.Pause();
+				}
+
+				owner->mActiveWorkers--;
+			}
+		}
+	};
+
+	template<int NumThreads>
+	thread_local std::uint32_t WorkStealingDispatcher<NumThreads>::sRandomState = 0x2545F491u;
+}
\ No newline at end of file